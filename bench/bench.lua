@@ -0,0 +1,43 @@
+-- Helpers shared by the microbenchmarks in this directory. Run them from
+-- the top of the tree after `make`, e.g.
+--
+--   lua bench/stdscr.lua [iterations]
+--
+-- curses is loaded from ./core.so and lua/curses, so what's measured is the
+-- build in the working tree. To compare against an older commit, check it
+-- out, rebuild and run the same script again.
+
+local bench = {}
+
+function bench.curses()
+  package.path = "lua/?.lua;lua/?/init.lua;" .. package.path
+  local open = package.loadlib("./core.so", "luaopen_curses_core")
+  if open then
+    package.preload["curses.core"] = open
+  end
+  return require("curses")
+end
+
+function bench.iterations(default)
+  return tonumber(arg and arg[1]) or default
+end
+
+-- times f(n), which should make n of the calls being measured
+function bench.run(results, name, n, f)
+  collectgarbage()
+  local t = os.clock()
+  f(n)
+  t = os.clock() - t
+  results[#results + 1] = string.format("%-36s %8.1f ns/call", name, t / n * 1e9)
+end
+
+-- leaves curses and prints what bench.run() collected
+function bench.report(curses, results)
+  curses.endwin()
+  print(_VERSION)
+  for _, line in ipairs(results) do
+    print(line)
+  end
+end
+
+return bench
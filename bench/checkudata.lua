@@ -0,0 +1,35 @@
+-- userdata type checks: the cost of calling trivial window and chstr
+-- methods, which is mostly checking the self argument. For before/after
+-- numbers, run it on a build of the commit that switched to lightuserdata-
+-- keyed metatables and on one of its parent.
+--
+--   lua bench/checkudata.lua [iterations]
+
+local bench = dofile("bench/bench.lua")
+local curses = bench.curses()
+local n = bench.iterations(1000000)
+
+curses.initscr()
+local results = {}
+local pad = curses.newpad(10, 10)
+local cs = curses.chstr(16)
+
+bench.run(results, "window:getyx()", n, function(n)
+  for i = 1, n do pad:getyx() end
+end)
+
+bench.run(results, "window:isvalid()", n, function(n)
+  for i = 1, n do pad:isvalid() end
+end)
+
+bench.run(results, "chstr:len()", n, function(n)
+  for i = 1, n do cs:len() end
+end)
+
+-- the failing check, which also builds an error message
+bench.run(results, "window:getyx() on a chstr (error)", math.floor(n / 10), function(n)
+  local getyx = pad.getyx
+  for i = 1, n do pcall(getyx, cs) end
+end)
+
+bench.report(curses, results)
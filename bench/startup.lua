@@ -0,0 +1,44 @@
+-- module startup: what loading curses.core costs a state now that
+-- constants are looked up on first use, against also loading all of them
+-- up front as luaopen_curses_core used to (that's what _loadconsts() does).
+-- Tools that spawn many short-lived states pay this once per state.
+--
+--   lua bench/startup.lua [iterations]
+
+local bench = dofile("bench/bench.lua")
+local curses = bench.curses()
+local open = assert(package.preload["curses.core"], "run after `make`, from the top of the tree")
+local n = bench.iterations(10000)
+local results = {}
+
+bench.run(results, "luaopen (lazy constants)", n, function(n)
+  for i = 1, n do open() end
+end)
+
+bench.run(results, "luaopen + _loadconsts() (eager)", n, function(n)
+  for i = 1, n do
+    local lib = open()
+    lib._loadconsts(lib)
+  end
+end)
+
+-- what a typical program then pays for the constants it uses
+bench.run(results, "luaopen + 10 constants", n, function(n)
+  for i = 1, n do
+    local lib = open()
+    local _ = lib.A_BOLD, lib.A_REVERSE, lib.COLOR_RED, lib.COLOR_BLACK,
+      lib.KEY_UP, lib.KEY_DOWN, lib.KEY_LEFT, lib.KEY_RIGHT, lib.KEY_ENTER,
+      lib.KEY_F1
+  end
+end)
+
+-- names that aren't constants are never cached, so each miss is a lookup
+bench.run(results, "miss: lib.notaconstant", n * 10, function(n)
+  for i = 1, n do local _ = curses.notaconstant end
+end)
+
+bench.run(results, "miss: lib.NOT_A_CONSTANT", n, function(n)
+  for i = 1, n do local _ = curses.NOT_A_CONSTANT end
+end)
+
+bench.report(curses, results)
@@ -0,0 +1,37 @@
+-- stdscr shortcuts: curses.addstr() etc. as C functions, against the Lua
+-- wrappers init.lua used to define for them (recreated below).
+--
+--   lua bench/stdscr.lua [iterations]
+
+local bench = dofile("bench/bench.lua")
+local curses = bench.curses()
+local n = bench.iterations(1000000)
+
+local wrapped = {}
+function wrapped.move(...) return curses.stdscr:move(...) end
+function wrapped.addch(...) return curses.stdscr:addch(...) end
+function wrapped.addstr(...) return curses.stdscr:addstr(...) end
+
+curses.initscr()
+local results = {}
+
+for _, impl in ipairs({ { "C", curses }, { "Lua wrapper", wrapped } }) do
+  local name, lib = impl[1], impl[2]
+
+  bench.run(results, "move(0, 0)            " .. name, n, function(n)
+    local move = lib.move
+    for i = 1, n do move(0, 0) end
+  end)
+
+  bench.run(results, "addch(0, 0, 'x')      " .. name, n, function(n)
+    local addch = lib.addch
+    for i = 1, n do addch(0, 0, "x") end
+  end)
+
+  bench.run(results, "addstr(0, 0, 'hello') " .. name, n, function(n)
+    local addstr = lib.addstr
+    for i = 1, n do addstr(0, 0, "hello") end
+  end)
+end
+
+bench.report(curses, results)
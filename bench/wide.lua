@@ -0,0 +1,35 @@
+-- addstr() against addwstr() on the same text: plain ASCII, which
+-- addwstr() widens without decoding, and mixed UTF-8, which both have to
+-- decode (addstr() in ncursesw, addwstr() with mbrtowc()). Needs a UTF-8
+-- locale, e.g.
+--
+--   LANG=C.UTF-8 lua bench/wide.lua [iterations]
+
+local bench = dofile("bench/bench.lua")
+local curses = bench.curses()
+local n = bench.iterations(200000)
+
+os.setlocale("")
+curses.initscr()
+local results = {}
+
+local texts = {
+  { "ascii", string.rep("The quick brown fox. ", 3) },
+  { "utf-8", string.rep("Grüße, naïve café — ✓ ", 3) },
+}
+
+for _, t in ipairs(texts) do
+  local name, s = t[1], t[2]
+
+  bench.run(results, "addstr(0, 0, " .. name .. ")", n, function(n)
+    local addstr = curses.addstr
+    for i = 1, n do addstr(0, 0, s) end
+  end)
+
+  bench.run(results, "addwstr(0, 0, " .. name .. ")", n, function(n)
+    local addwstr = curses.addwstr
+    for i = 1, n do addwstr(0, 0, s) end
+  end)
+end
+
+bench.report(curses, results)
@@ -2,19 +2,97 @@
 #include <string.h>
 #include <stdlib.h>
 
+char lc_chstrkey;
+
 chstr* lc_pushchstr(lua_State *L, int len)
 {
 	int sz = sizeof(chstr) + len * sizeof(chtype);
 	chstr *cs = (chstr*)lua_newuserdata(L, sz);
-	luaL_setmetatable(L, LC_CHSTRMT);
+	lc_setmetatable(L, &lc_chstrkey);
 	memset(cs, 0, sz);
 	cs->len = len;
+	cs->cap = len;
+	cs->str = cs->data;
+	cs->ref = LUA_NOREF;
+	return cs;
+}
+
+chstr* lc_pushchview(lua_State *L, int narg, size_t off, size_t len)
+{
+	chstr *parent = lc_checkchstr(L, narg);
+	chstr *cs = (chstr*)lua_newuserdata(L, sizeof(chstr));
+	lc_setmetatable(L, &lc_chstrkey);
+	memset(cs, 0, sizeof(chstr));
+	cs->len = len;
+
+	/* views of views point straight at the owner */
+	if (parent->parent) {
+		off += parent->off;
+		lua_rawgeti(L, LUA_REGISTRYINDEX, parent->ref);
+		parent = parent->parent;
+	} else {
+		lua_pushvalue(L, narg);
+	}
+	cs->parent = parent;
+	cs->off = off;
+	cs->ref = luaL_ref(L, LUA_REGISTRYINDEX);
 	return cs;
 }
 
 chstr* lc_checkchstr(lua_State *L, int narg)
 {
-	return (chstr*)luaL_checkudata(L, narg, LC_CHSTRMT);
+	return (chstr*)lc_checkudata(L, narg, &lc_chstrkey, LC_CHSTRMT);
+}
+
+/*
+* reads an optional inclusive [from, to] range at narg and narg+1, clamped
+* to the chstr. returns the number of cells in it (possibly 0).
+*/
+static size_t lc_chstrrange(lua_State *L, chstr *cs, int narg, size_t *from)
+{
+	int f = luaL_optint(L, narg, 0);
+	int t = luaL_optint(L, narg + 1, cs->len - 1);
+	if (f < 0)
+		f = 0;
+	if (t >= (int)cs->len)
+		t = cs->len - 1;
+	*from = f;
+	return t >= f ? t - f + 1 : 0;
+}
+
+/*
+* makes room for `need' cells, moving the chstr to a malloc'd buffer the
+* first time and growing it geometrically after that.
+*/
+static void lc_chstrreserve(lua_State *L, chstr *cs, size_t need)
+{
+	size_t cap = cs->cap < 8 ? 16 : cs->cap * 2;
+	chtype *buf;
+
+	if (need <= cs->cap)
+		return;
+	while (cap < need)
+		cap *= 2;
+
+	if (cs->str == cs->data) {
+		buf = malloc(cap * sizeof(chtype));
+		if (buf)
+			memcpy(buf, cs->data, cs->len * sizeof(chtype));
+	} else {
+		buf = realloc(cs->str, cap * sizeof(chtype));
+	}
+	if (!buf)
+		luaL_error(L, "out of memory");
+
+	cs->str = buf;
+	cs->cap = cap;
+}
+
+static chstr* lc_checkgrowable(lua_State *L, int narg)
+{
+	chstr *cs = lc_checkchstr(L, narg);
+	luaL_argcheck(L, cs->parent == NULL, narg, "can't resize a view");
+	return cs;
 }
 
 /*
@@ -26,9 +104,9 @@ static LUA_PROTO(lc_chstr)
 	chstr *cs;
 	chtype *ch, *chend;
 	int len = luaL_checkint(L, 1);
-	luaL_argcheck(L, len > 0, 1, "invalid length");
+	luaL_argcheck(L, len >= 0, 1, "invalid length");
 	cs = lc_pushchstr(L, len);
-	for (ch = cs->str, chend = ch + len; ch < chend; ch++)
+	for (ch = cs->data, chend = ch + len; ch < chend; ch++)
 		*ch = ' ';
 	return 1;
 }
@@ -40,13 +118,14 @@ static LUA_PROTO(lc_chstr)
 static LUA_PROTO(cs_set_str)
 {
 	chstr *cs = lc_checkchstr(L, 1);
+	chtype *cells = LC_CHSTR_STR(cs);
 	int offset = luaL_checkint(L, 2);
 	const char *str = luaL_checkstring(L, 3);
 	int attrs = luaL_optint(L, 4, 0);
 	int reps = luaL_optint(L, 5, 1);
 	int len = strlen(str);
 	int iters = len*reps;
-	int i;
+	int i, j;
 
 	luaL_argcheck(L, offset >= 0, 2, "invalid offset");
 	if (offset >= cs->len) {
@@ -56,9 +135,75 @@ static LUA_PROTO(cs_set_str)
 	if (offset + iters > cs->len)
 		iters = cs->len - offset;
 
-	for (i = 0; i < iters; i++)
-		cs->str[offset + i] = str[i % len] | attrs;
+	if (len == 1) {
+		chtype ch = (unsigned char)str[0] | attrs;
+		for (i = 0; i < iters; i++)
+			cells[offset + i] = ch;
+		return 0;
+	}
+
+	/* wrap the pattern index instead of taking i % len every cell */
+	for (i = 0, j = 0; i < iters; i++) {
+		cells[offset + i] = (unsigned char)str[j] | attrs;
+		if (++j == len)
+			j = 0;
+	}
+
+	return 0;
+}
+
+/*
+* void chstr:fill(int/str ch, [int attrs=A_NORMAL], [int from=0], [int to=len-1])
+* Sets every cell from `from' to `to' inclusive to the given char and attrs.
+*/
+static LUA_PROTO(cs_fill)
+{
+	chstr *cs = lc_checkchstr(L, 1);
+	chtype ch = luaL_checkchar(L, 2) | luaL_optint(L, 3, 0);
+	size_t from, n = lc_chstrrange(L, cs, 4, &from), i;
+	chtype *cells = LC_CHSTR_STR(cs) + from;
+
+	for (i = 0; i < n; i++)
+		cells[i] = ch;
+	return 0;
+}
+
+/*
+* void chstr:apply_attrs(int mask, int set, [int from=0], [int to=len-1])
+* Clears the attribute bits in `mask', then sets those in `set', for every
+* cell in the range. E.g. apply_attrs(A_COLOR, COLOR_PAIR(2)) recolors it,
+* and apply_attrs(0, A_BOLD) makes it bold without touching anything else.
+*/
+static LUA_PROTO(cs_apply_attrs)
+{
+	chstr *cs = lc_checkchstr(L, 1);
+	chtype keep = ~((chtype)luaL_checkint(L, 2) & A_ATTRIBUTES);
+	chtype set = (chtype)luaL_checkint(L, 3) & A_ATTRIBUTES;
+	size_t from, n = lc_chstrrange(L, cs, 4, &from), i;
+	chtype *cells = LC_CHSTR_STR(cs) + from;
+
+	for (i = 0; i < n; i++)
+		cells[i] = (cells[i] & keep) | set;
+	return 0;
+}
+
+/*
+* void chstr:replace_color(int oldpair, int newpair, [int from=0], [int to=len-1])
+* Changes every cell in the range using color pair `oldpair' to `newpair'.
+*/
+static LUA_PROTO(cs_replace_color)
+{
+	chstr *cs = lc_checkchstr(L, 1);
+	chtype oldc = COLOR_PAIR(luaL_checkint(L, 2));
+	chtype newc = COLOR_PAIR(luaL_checkint(L, 3));
+	size_t from, n = lc_chstrrange(L, cs, 4, &from), i;
+	chtype *cells = LC_CHSTR_STR(cs) + from;
 
+	/* written as a select so the compiler can vectorize it */
+	for (i = 0; i < n; i++) {
+		chtype c = cells[i];
+		cells[i] = (c & A_COLOR) == oldc ? (c & ~A_COLOR) | newc : c;
+	}
 	return 0;
 }
 
@@ -86,7 +231,7 @@ static LUA_PROTO(cs_set_ch)
 		reps = cs->len - offset;
 
 	for (i = 0; i < reps; i++)
-		cs->str[offset + i] = ch | attrs;
+		LC_CHSTR_STR(cs)[offset + i] = ch | attrs;
 
 	return 0;
 }
@@ -105,7 +250,7 @@ static LUA_PROTO(cs_get)
 	if (offset >= cs->len)
 		return 0;
 
-	ch = cs->str[offset];
+	ch = LC_CHSTR_STR(cs)[offset];
 	lua_pushnumber(L, ch & A_CHARTEXT);
 	lua_pushnumber(L, ch & A_ATTRIBUTES);
 	lua_pushnumber(L, ch & A_COLOR);
@@ -120,11 +265,12 @@ static LUA_PROTO(cs_get)
 static LUA_PROTO(cs_get_str)
 {
 	chstr *cs = lc_checkchstr(L, 1);
+	chtype *cells = LC_CHSTR_STR(cs);
 	/* don't look at this */
 	char *b = malloc(cs->len + 1);
 	int i;
-	for (i = 0; i < cs->len && cs->str[i] != 0; i++)
-		b[i] = cs->str[i] & A_CHARTEXT;
+	for (i = 0; i < cs->len && cells[i] != 0; i++)
+		b[i] = cells[i] & A_CHARTEXT;
 	b[i] = '\0';
 	lua_pushstring(L, b);
 	free(b);
@@ -153,7 +299,102 @@ static LUA_PROTO(cs_dup)
 {
 	chstr *cs = lc_checkchstr(L, 1);
 	chstr *copy = lc_pushchstr(L, cs->len);
-	memcpy(copy->str, cs->str, cs->len * sizeof(chtype));
+	memcpy(copy->str, LC_CHSTR_STR(cs), cs->len * sizeof(chtype));
+	return 1;
+}
+
+/*
+* void chstr:append_str(str value, [int attrs=A_NORMAL])
+* Adds the string to the end of the chstr, growing it.
+*/
+static LUA_PROTO(cs_append_str)
+{
+	chstr *cs = lc_checkgrowable(L, 1);
+	size_t len, i;
+	const char *str = luaL_checklstring(L, 2, &len);
+	chtype attrs = luaL_optint(L, 3, 0);
+	chtype *cells;
+
+	lc_chstrreserve(L, cs, cs->len + len);
+	cells = cs->str + cs->len;
+	for (i = 0; i < len; i++)
+		cells[i] = (unsigned char)str[i] | attrs;
+	cs->len += len;
+	return 0;
+}
+
+/*
+* void chstr:append_ch(int/str ch, [int attrs=A_NORMAL], [int reps=1])
+* Adds the char to the end of the chstr `reps' times, growing it.
+*/
+static LUA_PROTO(cs_append_ch)
+{
+	chstr *cs = lc_checkgrowable(L, 1);
+	chtype ch = luaL_checkchar(L, 2) | luaL_optint(L, 3, 0);
+	int reps = luaL_optint(L, 4, 1);
+	chtype *cells;
+	int i;
+
+	if (reps <= 0)
+		return 0;
+	lc_chstrreserve(L, cs, cs->len + reps);
+	cells = cs->str + cs->len;
+	for (i = 0; i < reps; i++)
+		cells[i] = ch;
+	cs->len += reps;
+	return 0;
+}
+
+/*
+* void chstr:append_chstr(chstr other)
+* Adds a copy of the other chstr (or view) to the end of this one.
+*/
+static LUA_PROTO(cs_append_chstr)
+{
+	chstr *cs = lc_checkgrowable(L, 1);
+	chstr *other = lc_checkchstr(L, 2);
+	size_t len = other->len;
+
+	lc_chstrreserve(L, cs, cs->len + len);
+	/* look this up after growing, `other' may be (a view of) ourself */
+	memcpy(cs->str + cs->len, LC_CHSTR_STR(other), len * sizeof(chtype));
+	cs->len += len;
+	return 0;
+}
+
+/*
+* void chstr:truncate(int len)
+* Shortens the chstr to `len' cells. Its buffer is kept for later appends.
+*/
+static LUA_PROTO(cs_truncate)
+{
+	chstr *cs = lc_checkgrowable(L, 1);
+	int len = luaL_checkint(L, 2);
+	luaL_argcheck(L, len >= 0, 2, "invalid length");
+	if ((size_t)len < cs->len)
+		cs->len = len;
+	return 0;
+}
+
+/*
+* chstr chstr:sub(int from, [int to])
+* Returns a view of the cells from `from' to `to' inclusive (0-based, like
+* the other offsets; `to' defaults to the end). Nothing is copied: the view
+* shares cells with the original, and writing to one changes the other.
+* Use dup() on the result for an independent copy.
+*/
+static LUA_PROTO(cs_sub)
+{
+	chstr *cs = lc_checkchstr(L, 1);
+	int from = luaL_checkint(L, 2);
+	int to = luaL_optint(L, 3, cs->len - 1);
+
+	if (from < 0)
+		from = 0;
+	if (to >= (int)cs->len)
+		to = cs->len - 1;
+
+	lc_pushchview(L, 1, from, to >= from ? to - from + 1 : 0);
 	return 1;
 }
 
@@ -168,23 +409,52 @@ static LUA_PROTO(cs___tostring)
 	return 1;
 }
 
+/*
+* void chstr:__gc()
+* Releases a view's hold on its parent, or a grown chstr's buffer.
+*/
+static LUA_PROTO(cs___gc)
+{
+	chstr *cs = lc_checkchstr(L, 1);
+	if (cs->str != cs->data && !cs->parent) {
+		free(cs->str);
+		cs->str = cs->data;
+		cs->len = cs->cap = 0;
+	}
+	if (cs->parent) {
+		luaL_unref(L, LUA_REGISTRYINDEX, cs->ref);
+		cs->parent = NULL;
+		cs->ref = LUA_NOREF;
+	}
+	return 0;
+}
+
 #define LCF(fn) { #fn, cs_ ## fn }
 
 static const luaL_Reg chstrfuncs[] = {
 	LCF(__tostring),
+	LCF(__gc),
 	{ "__len", cs_len },
 	LCF(set_str),
 	LCF(set_ch),
+	LCF(fill),
+	LCF(apply_attrs),
+	LCF(replace_color),
 	LCF(get),
 	LCF(get_str),
 	LCF(len),
 	LCF(dup),
+	LCF(sub),
+	LCF(append_str),
+	LCF(append_ch),
+	LCF(append_chstr),
+	LCF(truncate),
 	{ NULL, NULL }
 };
 
 void lc_reg_chstr(lua_State *L)
 {
-	luaL_newmetatable(L, LC_CHSTRMT);
+	lc_newmetatable(L, &lc_chstrkey, LC_CHSTRMT);
 	lua_pushvalue(L, -1);
 	lua_setfield(L, -2, "__index");
 
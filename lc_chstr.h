@@ -5,13 +5,26 @@
 
 #define LC_CHSTRMT "lc-chstr"
 
+extern char lc_chstrkey; /* registry key of the chstr metatable */
+
 typedef struct chstr {
 	size_t len;
-	chtype str[1];
+	size_t cap;           /* cells allocated at `str' */
+	chtype *str;          /* the cells: `data', or malloc'd once appended to */
+	struct chstr *parent; /* for views, the chstr we point into */
+	size_t off;           /* for views, our offset into the parent */
+	int ref;              /* for views, registry ref keeping the parent alive */
+	chtype data[1];
 } chstr;
 
+/* a view's cells are always found through its parent, whose buffer may move */
+#define LC_CHSTR_STR(cs) ((cs)->parent ? (cs)->parent->str + (cs)->off : (cs)->str)
+
 void lc_reg_chstr(lua_State *L);
 chstr* lc_pushchstr(lua_State *L, int len);
 chstr* lc_checkchstr(lua_State *L, int narg);
 
+/* pushes a view of `len' cells of the chstr at `narg', starting at `off' */
+chstr* lc_pushchview(lua_State *L, int narg, size_t off, size_t len);
+
 #endif
@@ -77,6 +77,43 @@
   LCC(COLOR_MAGENTA)
   LCC(COLOR_WHITE)
 
+/* Mouse events */
+
+#ifdef NCURSES_MOUSE_VERSION
+  LCC(BUTTON1_PRESSED)
+  LCC(BUTTON1_RELEASED)
+  LCC(BUTTON1_CLICKED)
+  LCC(BUTTON1_DOUBLE_CLICKED)
+  LCC(BUTTON1_TRIPLE_CLICKED)
+  LCC(BUTTON2_PRESSED)
+  LCC(BUTTON2_RELEASED)
+  LCC(BUTTON2_CLICKED)
+  LCC(BUTTON2_DOUBLE_CLICKED)
+  LCC(BUTTON2_TRIPLE_CLICKED)
+  LCC(BUTTON3_PRESSED)
+  LCC(BUTTON3_RELEASED)
+  LCC(BUTTON3_CLICKED)
+  LCC(BUTTON3_DOUBLE_CLICKED)
+  LCC(BUTTON3_TRIPLE_CLICKED)
+  LCC(BUTTON4_PRESSED)
+  LCC(BUTTON4_RELEASED)
+  LCC(BUTTON4_CLICKED)
+  LCC(BUTTON4_DOUBLE_CLICKED)
+  LCC(BUTTON4_TRIPLE_CLICKED)
+#ifdef BUTTON5_PRESSED
+  LCC(BUTTON5_PRESSED)
+  LCC(BUTTON5_RELEASED)
+  LCC(BUTTON5_CLICKED)
+  LCC(BUTTON5_DOUBLE_CLICKED)
+  LCC(BUTTON5_TRIPLE_CLICKED)
+#endif
+  LCC(BUTTON_CTRL)
+  LCC(BUTTON_SHIFT)
+  LCC(BUTTON_ALT)
+  LCC(REPORT_MOUSE_POSITION)
+  LCC(ALL_MOUSE_EVENTS)
+#endif
+
 /* Keys */
 
   LCC(KEY_MIN)
@@ -0,0 +1,480 @@
+#define _POSIX_C_SOURCE 200112L
+#include "lc_event.h"
+#include "lc_window.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+* timers are kept in a binary min-heap ordered by due time, with their
+* callbacks in the registry. the callbacks belong to a lua_State, so each
+* state has its own heap, in a registry userdata that frees it on close.
+*/
+typedef struct lctimer {
+	double due;      /* ms, on lc_now()'s clock */
+	double interval; /* ms between repeats, or 0 for a one-shot */
+	int ref;         /* registry ref of the callback */
+	int id;
+} lctimer;
+
+typedef struct lctimers {
+	lctimer *heap;
+	int n, cap;
+	int lastid;
+} lctimers;
+
+static char lc_timerskey;
+
+static int lc_running = 0;  /* inside curses.run() */
+static int lc_stopping = 0; /* curses.stop() was called */
+static int lc_redraw = 0;   /* curses.redraw() was called */
+
+static double lc_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* rounds a delay in ms up to a poll() timeout, so we never wake too early */
+static int lc_mstimeout(double ms)
+{
+	int t;
+	if (ms <= 0)
+		return 0;
+	t = (int)ms;
+	return t < ms ? t + 1 : t;
+}
+
+static LUA_PROTO(lc_timersgc)
+{
+	lctimers *tm = (lctimers*)lua_touserdata(L, 1);
+	int i;
+	for (i = 0; i < tm->n; i++)
+		luaL_unref(L, LUA_REGISTRYINDEX, tm->heap[i].ref);
+	free(tm->heap);
+	tm->heap = NULL;
+	tm->n = tm->cap = 0;
+	return 0;
+}
+
+static lctimers* lc_gettimers(lua_State *L)
+{
+	lctimers *tm;
+	lua_pushlightuserdata(L, &lc_timerskey);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	tm = (lctimers*)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return tm;
+}
+
+static void lc_timerup(lctimers *tm, int i)
+{
+	lctimer t = tm->heap[i];
+	while (i > 0) {
+		int p = (i - 1) / 2;
+		if (tm->heap[p].due <= t.due)
+			break;
+		tm->heap[i] = tm->heap[p];
+		i = p;
+	}
+	tm->heap[i] = t;
+}
+
+static void lc_timerdown(lctimers *tm, int i)
+{
+	lctimer t = tm->heap[i];
+	for (;;) {
+		int c = 2 * i + 1;
+		if (c >= tm->n)
+			break;
+		if (c + 1 < tm->n && tm->heap[c + 1].due < tm->heap[c].due)
+			c++;
+		if (t.due <= tm->heap[c].due)
+			break;
+		tm->heap[i] = tm->heap[c];
+		i = c;
+	}
+	tm->heap[i] = t;
+}
+
+/* removes the timer at heap index i and returns it */
+static lctimer lc_timerremove(lctimers *tm, int i)
+{
+	lctimer t = tm->heap[i];
+	tm->heap[i] = tm->heap[--tm->n];
+	if (i < tm->n) {
+		lc_timerdown(tm, i);
+		lc_timerup(tm, i);
+	}
+	return t;
+}
+
+/*
+* calls every timer that's due. repeating timers are rescheduled before
+* their callback runs, so it can cancel them.
+* returns 0 with the error on the stack if a callback failed.
+*/
+static int lc_firetimers(lua_State *L, lctimers *tm, double now)
+{
+	while (tm->n > 0 && tm->heap[0].due <= now) {
+		lctimer t = tm->heap[0];
+
+		if (t.interval > 0) {
+			/* if we fell behind, skip the missed runs instead of bursting */
+			tm->heap[0].due += t.interval;
+			if (tm->heap[0].due <= now)
+				tm->heap[0].due = now + t.interval;
+			lc_timerdown(tm, 0);
+			lua_rawgeti(L, LUA_REGISTRYINDEX, t.ref);
+		} else {
+			lc_timerremove(tm, 0);
+			lua_rawgeti(L, LUA_REGISTRYINDEX, t.ref);
+			luaL_unref(L, LUA_REGISTRYINDEX, t.ref);
+		}
+
+		lua_pushinteger(L, t.id);
+		if (lua_pcall(L, 1, 0, 0) != 0)
+			return 0;
+		if (lc_stopping)
+			break;
+	}
+	return 1;
+}
+
+/*
+* reads every key curses has ready and passes it to handlers.key, merging
+* runs of the same key if `coalesce' is set. keys are read through the
+* input pad (with stdscr's keypad setting), since wgetch(stdscr) would
+* refresh stdscr behind the draw handler's back.
+* returns 0 with the error on the stack if the handler failed.
+*/
+static int lc_readkeys(lua_State *L, int handlers, int coalesce)
+{
+	WINDOW *pad;
+	int ch;
+
+	while (!lc_stopping) {
+		int nargs = 1;
+
+		/* a handler may have changed stdscr's keypad mode */
+		if (!(pad = lc_inputpad(lc_getkeypad(stdscr)))) {
+			lua_pushliteral(L, "can't create the input pad");
+			return 0;
+		}
+		if ((ch = wgetch(pad)) == ERR)
+			break;
+
+		if (LC_ISPASTE(ch)) {
+			lua_getfield(L, handlers, "paste");
+			if (lua_isnil(L, -1)) {
+				/* no paste handler, hand it to key() */
+				lua_pop(L, 1);
+				lua_getfield(L, handlers, "key");
+				lua_pushinteger(L, ch);
+				nargs++;
+			}
+			lc_pushpaste(L, pad);
+		} else {
+			lua_getfield(L, handlers, "key");
+			lua_pushinteger(L, ch);
+			if (coalesce) {
+				lua_pushinteger(L, lc_countrepeats(L, pad, ch));
+				nargs++;
+			}
+		}
+
+		if (lua_isnil(L, -nargs - 1)) {
+			lua_pop(L, nargs + 1);
+			continue;
+		}
+		if (lua_pcall(L, nargs, 0, 0) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+* void curses.run(table handlers)
+* Runs an event loop until curses.stop() is called, sleeping in poll() on
+* the terminal until a key arrives or a timer is due, so an idle program
+* uses no CPU. Handlers:
+*   key(int ch)  called for every key read from stdscr
+*   paste(str)   called with the text of a bracketed paste; if missing,
+*                key(KEY_PASTE, str) is called instead
+*   draw()       called after curses.redraw() (and once at the start),
+*                followed by doupdate(); at most `fps' times a second
+*   fps          frame rate cap, default 60
+*   coalesce     if true, repeats of a key that are already waiting are
+*                merged and key(ch, count) is called once for them
+* Timers are added with curses.timer(). Keys are read without refreshing
+* stdscr, and its delay mode is left alone. An error in a callback stops
+* the loop and is rethrown.
+*/
+static LUA_PROTO(c_run)
+{
+	lctimers *tm = lc_gettimers(L);
+	double fps, frame, nextframe = 0;
+	int ok = 1, coalesce;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_settop(L, 1);
+	lua_getfield(L, 1, "fps");
+	/* anything but a positive number (or nil) is refused below */
+	fps = lua_isnil(L, -1) ? 60 : lua_tonumber(L, -1);
+	lua_pop(L, 1);
+	luaL_argcheck(L, fps > 0, 1, "fps must be a positive number");
+	frame = 1000.0 / fps;
+	lua_getfield(L, 1, "coalesce");
+	coalesce = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	if (!lc_initonce)
+		return luaL_error(L, "must call initscr() first");
+	if (lc_running)
+		return luaL_error(L, "curses.run() is already running");
+
+	lc_running = 1;
+	lc_stopping = 0;
+	lc_redraw = 1;
+
+	while (!lc_stopping) {
+		struct pollfd pfd;
+		int timeout = -1;
+		double now = lc_now();
+
+		if (!(ok = lc_firetimers(L, tm, now)) || !(ok = lc_readkeys(L, 1, coalesce)))
+			break;
+		if (lc_stopping)
+			break;
+
+		/* coalesce redraw requests into one doupdate() per frame */
+		now = lc_now();
+		if (lc_redraw && now >= nextframe) {
+			lc_redraw = 0;
+			lua_getfield(L, 1, "draw");
+			if (lua_isnil(L, -1))
+				lua_pop(L, 1);
+			else if (!(ok = lua_pcall(L, 0, 0, 0) == 0))
+				break;
+			doupdate();
+			nextframe = now + frame;
+			if (lc_stopping)
+				break;
+		}
+
+		if (lc_redraw)
+			timeout = lc_mstimeout(nextframe - now);
+		if (tm->n > 0) {
+			int t = lc_mstimeout(tm->heap[0].due - now);
+			if (timeout < 0 || t < timeout)
+				timeout = t;
+		}
+
+		pfd.fd = STDIN_FILENO;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+			lua_pushfstring(L, "poll: %s", strerror(errno));
+			ok = 0;
+			break;
+		}
+	}
+
+	lc_running = 0;
+	if (!ok)
+		lua_error(L);
+	return 0;
+}
+
+/*
+* void curses.stop()
+* Makes curses.run() return once the current callback finishes.
+*/
+static LUA_PROTO(c_stop)
+{
+	lc_stopping = 1;
+	return 0;
+}
+
+/*
+* void curses.redraw()
+* Asks curses.run() to call handlers.draw() and doupdate() at the next frame.
+* Any number of calls before then result in a single redraw.
+*/
+static LUA_PROTO(c_redraw)
+{
+	lc_redraw = 1;
+	return 0;
+}
+
+/*
+* int curses.timer(int ms, func callback, [bool repeat=false])
+* Calls callback(id) from curses.run() after `ms' milliseconds, and every
+* `ms' milliseconds after that if `repeat' is true. Returns the id.
+*/
+static LUA_PROTO(c_timer)
+{
+	lctimers *tm = lc_gettimers(L);
+	double ms = luaL_checknumber(L, 1);
+	int repeat = luaL_optbool(L, 3, 0);
+	lctimer t;
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	luaL_argcheck(L, repeat ? ms > 0 : ms >= 0, 1, "invalid delay");
+
+	if (tm->n == tm->cap) {
+		int cap = tm->cap ? tm->cap * 2 : 16;
+		lctimer *heap = realloc(tm->heap, cap * sizeof(lctimer));
+		if (!heap)
+			return luaL_error(L, "out of memory");
+		tm->heap = heap;
+		tm->cap = cap;
+	}
+
+	lua_pushvalue(L, 2);
+	t.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	t.due = lc_now() + ms;
+	t.interval = repeat ? ms : 0;
+	t.id = ++tm->lastid;
+
+	tm->heap[tm->n] = t;
+	lc_timerup(tm, tm->n++);
+
+	lua_pushinteger(L, t.id);
+	return 1;
+}
+
+/*
+* bool curses.cancel_timer(int id)
+* Removes a timer. Returns false if there's no such timer (e.g. it was a
+* one-shot that already ran).
+*/
+static LUA_PROTO(c_cancel_timer)
+{
+	lctimers *tm = lc_gettimers(L);
+	int id = luaL_checkint(L, 1);
+	int i;
+	for (i = 0; i < tm->n; i++) {
+		if (tm->heap[i].id == id) {
+			lctimer t = lc_timerremove(tm, i);
+			luaL_unref(L, LUA_REGISTRYINDEX, t.ref);
+			lua_pushboolean(L, 1);
+			return 1;
+		}
+	}
+	lua_pushboolean(L, 0);
+	return 1;
+}
+
+/*
+* returns true if curses already has input buffered that poll() can't see.
+* peeks with a non-blocking read on the input pad and pushes the key back.
+* the pad's keypad mode follows stdscr's: wgetch() switches the terminal's
+* keypad transmit mode to match the window it reads.
+*/
+static int lc_inputpending(void)
+{
+	WINDOW *pad;
+	int ch;
+
+	if (!lc_initonce || !(pad = lc_inputpad(lc_getkeypad(stdscr))))
+		return 0;
+
+	ch = wgetch(pad);
+	if (ch == ERR)
+		return 0;
+	ungetch(ch);
+	return 1;
+}
+
+/*
+* table curses.wait([table fds], [int timeout=-1])
+* Waits until the terminal (fd 0) or any of the given file descriptors is
+* readable, or `timeout' milliseconds pass (-1 waits forever). Keys curses
+* has already read ahead count as ready input. Returns an array of the
+* ready descriptors, empty on timeout, or nil and a message on error.
+*/
+static LUA_PROTO(c_wait)
+{
+	int timeout = luaL_optint(L, 2, -1);
+	int nfds = 1, i, n = 0, rv;
+	struct pollfd *pfds;
+
+	if (!lua_isnoneornil(L, 1)) {
+		luaL_checktype(L, 1, LUA_TTABLE);
+		nfds += LC_RAWLEN(L, 1);
+	}
+
+	pfds = (struct pollfd*)lc_scratch(L, nfds * sizeof(struct pollfd));
+	pfds[0].fd = STDIN_FILENO;
+	for (i = 1; i < nfds; i++) {
+		lua_rawgeti(L, 1, i);
+		if (lua_type(L, -1) != LUA_TNUMBER)
+			return luaL_error(L, "bad file descriptor at index %d", i);
+		pfds[i].fd = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	for (i = 0; i < nfds; i++) {
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+	}
+
+	/* don't sleep on input curses is already holding */
+	if (lc_inputpending()) {
+		pfds[0].revents = POLLIN;
+		rv = poll(pfds + 1, nfds - 1, 0);
+	} else {
+		rv = poll(pfds, nfds, timeout);
+	}
+
+	if (rv < 0 && errno != EINTR) {
+		lua_pushnil(L);
+		lua_pushstring(L, strerror(errno));
+		return 2;
+	}
+
+	lua_newtable(L);
+	if (rv < 0)
+		return 1;
+	for (i = 0; i < nfds; i++) {
+		if (pfds[i].revents) {
+			lua_pushinteger(L, pfds[i].fd);
+			lua_rawseti(L, -2, ++n);
+		}
+	}
+	return 1;
+}
+
+#define LCF(fn) { #fn, c_ ## fn }
+
+static const luaL_Reg eventfuncs[] = {
+	LCF(run),
+	LCF(stop),
+	LCF(redraw),
+	LCF(timer),
+	LCF(cancel_timer),
+	LCF(wait),
+	{ NULL, NULL }
+};
+
+void lc_reg_event(lua_State *L)
+{
+	/* kept if we're loaded again into the same state */
+	if (!lc_gettimers(L)) {
+		lctimers *tm;
+		lua_pushlightuserdata(L, &lc_timerskey);
+		tm = (lctimers*)lua_newuserdata(L, sizeof(lctimers));
+		memset(tm, 0, sizeof(lctimers));
+		lua_newtable(L);
+		lua_pushcfunction(L, lc_timersgc);
+		lua_setfield(L, -2, "__gc");
+		lua_setmetatable(L, -2);
+		lua_rawset(L, LUA_REGISTRYINDEX);
+	}
+
+	LC_REGISTER(L, eventfuncs);
+}
@@ -0,0 +1,8 @@
+#ifndef LC_EVENT_H
+#define LC_EVENT_H
+
+#include "luacurses.h"
+
+void lc_reg_event(lua_State *L);
+
+#endif
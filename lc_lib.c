@@ -1,6 +1,8 @@
 #include <string.h>
+#include <stdio.h>
 #include "lc_lib.h"
 #include "lc_window.h"
+#include "lc_wide.h"
 
 int lc_initonce = 0;
 
@@ -271,6 +273,91 @@ static LUA_PROTO(c_flash)
 	return 1;
 }
 
+/*
+* pushes the table constants set at runtime go in: the curses table, which
+* must be upvalue 1, or _G once curses.global has set _NOLIB.
+*/
+static void lc_pushconsttable(lua_State *L)
+{
+	lua_getfield(L, lua_upvalueindex(1), "_NOLIB");
+	if (lua_toboolean(L, -1)) {
+		lua_pop(L, 1);
+#if LUA_VERSION_NUM >= 502
+		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+#else
+		lua_pushvalue(L, LUA_GLOBALSINDEX);
+#endif
+	} else {
+		lua_pop(L, 1);
+		lua_pushvalue(L, lua_upvalueindex(1));
+	}
+}
+
+/*
+* bool curses.bracketed_paste(bool enable)
+* Asks the terminal to mark pasted text, so getch() can return a whole paste
+* at once as KEY_PASTE and a string instead of one key per character. keypad
+* must be enabled on the window being read. KEY_PASTE is set when this is
+* turned on, to a code none of the terminal's keys use, and cleared when
+* it's turned off; while it's off no key is taken for a paste. Turn it off again before exiting, since the
+* terminal keeps it on after endwin(). Needs ncurses' define_key().
+*/
+#ifdef NCURSES_VERSION
+/* key codes are kept in an unsigned short by ncurses */
+#define LC_MAXKEYCODE 0xFFFF
+
+/* returns a key code the terminal doesn't use, or -1 */
+static int lc_freekeycode(void)
+{
+	int key;
+	for (key = KEY_MAX + 1; key <= LC_MAXKEYCODE; key++) {
+		const char *kname = keyname(key);
+		if (has_key(key))
+			continue;
+		if (!kname || !strcmp(kname, "UNKNOWN KEY"))
+			return key;
+	}
+	return -1;
+}
+#endif
+
+static LUA_PROTO(c_bracketed_paste)
+{
+	int enable = luaL_checkbool(L, 1);
+#ifdef NCURSES_VERSION
+	static int owned = 0; /* did we define the key, or was it the terminal's? */
+
+	if (enable && lc_pastekey <= 0) {
+		int key = key_defined(LC_PASTE_BEGIN);
+		owned = key <= 0;
+		if (owned) {
+			if ((key = lc_freekeycode()) < 0 ||
+			    define_key(LC_PASTE_BEGIN, key) == ERR)
+				LC_PUSHTRUE(L, 0);
+		}
+		lc_pastekey = key;
+		lc_pushconsttable(L);
+		lua_pushinteger(L, key);
+		lua_setfield(L, -2, "KEY_PASTE");
+		lua_pop(L, 1);
+	} else if (!enable && lc_pastekey > 0) {
+		if (owned)
+			define_key(NULL, lc_pastekey);
+		lc_pastekey = 0;
+		lc_pushconsttable(L);
+		lua_pushnil(L);
+		lua_setfield(L, -2, "KEY_PASTE");
+		lua_pop(L, 1);
+	}
+	fputs(enable ? "\033[?2004h" : "\033[?2004l", stdout);
+	fflush(stdout);
+	LC_PUSHTRUE(L, 1);
+#else
+	(void)enable;
+	LC_PUSHTRUE(L, 0);
+#endif
+}
+
 /*
 * bool curses.flushinp()
 * Throws away any typeahead that has been typed by the user but not yet read
@@ -398,20 +485,7 @@ static LUA_PROTO(c_initscr)
 		return 1;
 	}
 
-	/* only slightly awful! */
-	lua_pushvalue(L, lua_upvalueindex(1));
-	lua_getfield(L, -1, "_NOLIB");
-	if (lua_toboolean(L, -1)) {
-		lua_pop(L, 2);
-#if LUA_VERSION_NUM >= 502
-		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
-#else
-		lua_pushvalue(L, LUA_GLOBALSINDEX);
-#endif
-		lua_pushvalue(L, -1);
-	} else {
-		lua_pop(L, 1);
-	}
+	lc_pushconsttable(L);
 
 	/*
 	* Once upon a time, SGI didn't initialize ACS_* constants until the first
@@ -752,14 +826,233 @@ static LUA_PROTO(c_use_env)
 	return 0;
 }
 
+#ifdef NCURSES_MOUSE_VERSION
+/*
+* int id, int x, int y, int z, int bstate = curses.getmouse()
+* Returns the mouse event that caused getch() to return KEY_MOUSE, or nil.
+*/
+static LUA_PROTO(c_getmouse)
+{
+	MEVENT ev;
+	if (getmouse(&ev) != OK)
+		return 0;
+	lua_pushinteger(L, ev.id);
+	lua_pushinteger(L, ev.x);
+	lua_pushinteger(L, ev.y);
+	lua_pushinteger(L, ev.z);
+	lua_pushinteger(L, (lua_Integer)ev.bstate);
+	return 5;
+}
+
+static const char *const lc_mousefields[] = { "id", "x", "y", "z", "bstate" };
+#define LC_MOUSEFIELDS 5
+
+/* stores `ev' at index n of the column tables starting at stack index col */
+static void lc_setmouse(lua_State *L, int col, int n, MEVENT *ev)
+{
+	lua_pushinteger(L, ev->id);
+	lua_rawseti(L, col, n);
+	lua_pushinteger(L, ev->x);
+	lua_rawseti(L, col + 1, n);
+	lua_pushinteger(L, ev->y);
+	lua_rawseti(L, col + 2, n);
+	lua_pushinteger(L, ev->z);
+	lua_rawseti(L, col + 3, n);
+	lua_pushinteger(L, (lua_Integer)ev->bstate);
+	lua_rawseti(L, col + 4, n);
+}
+
+/*
+* table, int curses.getmouse_all([table ev], [bool coalesce=false])
+* Call after getch() returns KEY_MOUSE. Takes that event and every mouse
+* event queued behind it, without blocking, and stores them column-wise in
+* the arrays ev.id, ev.x, ev.y, ev.z and ev.bstate (created if missing).
+* Returns ev and the number of events; entries past that are left over from
+* earlier calls, so passing the same table each time doesn't allocate once
+* it has grown. With coalesce, a run of motion events with the same bstate
+* only keeps the last position. Input that isn't a mouse event is pushed
+* back for getch().
+*/
+static LUA_PROTO(c_getmouse_all)
+{
+	int coalesce = luaL_optbool(L, 2, 0);
+	WINDOW *pad;
+	int n = 0, i, ch;
+	mmask_t last = 0;
+	MEVENT ev;
+
+	lua_settop(L, 1);
+	if (lua_isnil(L, 1)) {
+		lua_newtable(L);
+		lua_replace(L, 1);
+	}
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	for (i = 0; i < LC_MOUSEFIELDS; i++) {
+		lua_getfield(L, 1, lc_mousefields[i]);
+		if (!lua_istable(L, -1)) {
+			lua_pop(L, 1);
+			lua_newtable(L);
+			lua_pushvalue(L, -1);
+			lua_setfield(L, 1, lc_mousefields[i]);
+		}
+	}
+
+	/* read through the input pad, with keypad on so mouse events are decoded
+	   whatever the caller's windows use, and without refreshing stdscr */
+	if (!lc_initonce || !(pad = lc_inputpad(TRUE)))
+		goto done;
+
+	/* one event per KEY_MOUSE, so we don't depend on how ncurses queues them */
+	ch = KEY_MOUSE;
+	while (ch == KEY_MOUSE) {
+		if (getmouse(&ev) == OK) {
+			if (!coalesce || n == 0 || ev.bstate != last ||
+			    !(ev.bstate & REPORT_MOUSE_POSITION))
+				n++;
+			last = ev.bstate;
+			lc_setmouse(L, 2, n, &ev);
+		}
+		ch = wgetch(pad);
+	}
+	if (ch != ERR)
+		ungetch(ch);
+
+done:
+	lua_settop(L, 1);
+	lua_pushinteger(L, n);
+	return 2;
+}
+
+/*
+* int curses.mouseinterval([int ms])
+* Sets the longest time between a press and release that still counts as a
+* click, and returns the old value. With no argument, just returns it.
+*/
+static LUA_PROTO(c_mouseinterval)
+{
+	lua_pushinteger(L, mouseinterval(luaL_optint(L, 1, -1)));
+	return 1;
+}
+
+/*
+* int new, int old = curses.mousemask(int mask)
+* Chooses which mouse events are reported, e.g. ALL_MOUSE_EVENTS or
+* REPORT_MOUSE_POSITION. Returns the mask that's now in effect (0 if the
+* mouse isn't supported) and the previous one.
+*/
+static LUA_PROTO(c_mousemask)
+{
+	mmask_t old = 0;
+	mmask_t avail = mousemask((mmask_t)luaL_checknumber(L, 1), &old);
+	lua_pushinteger(L, (lua_Integer)avail);
+	lua_pushinteger(L, (lua_Integer)old);
+	return 2;
+}
+
+/*
+* bool curses.ungetmouse(int id, int x, int y, int z, int bstate)
+* Pushes a mouse event, and a KEY_MOUSE for it, onto the input queue.
+*/
+static LUA_PROTO(c_ungetmouse)
+{
+	MEVENT ev;
+	ev.id = (short)luaL_checkint(L, 1);
+	ev.x = luaL_checkint(L, 2);
+	ev.y = luaL_checkint(L, 3);
+	ev.z = luaL_checkint(L, 4);
+	ev.bstate = (mmask_t)luaL_checknumber(L, 5);
+	lua_pushboolean(L, ungetmouse(&ev) != ERR);
+	return 1;
+}
+#endif
+
 #ifdef LC_WIDE
+/*
+* str curses.erasewchar()
+* Returns the user's erase character, or nil.
+*/
 static LUA_PROTO(c_erasewchar)
-static LUA_PROTO(c_getcchar)
+{
+	wchar_t wc;
+	if (erasewchar(&wc) == ERR)
+		return 0;
+	lc_pushwstr(L, &wc, 1);
+	return 1;
+}
+
+/*
+* curses.getcchar(), curses.setcchar()
+* TODO. There's no Lua type for cchar_t; the wide functions take and return
+* a char and its attributes instead.
+*/
+LUA_UNIMP(c_getcchar)
+
+/*
+* str curses.key_name(int/str ch)
+* Like keyname(), for a wide character.
+*/
 static LUA_PROTO(c_key_name)
+{
+	const char *name = key_name(lc_checkwchar(L, 1));
+	if (name)
+		lua_pushstring(L, name);
+	else
+		lua_pushnil(L);
+	return 1;
+}
+
+/*
+* str curses.killwchar()
+* Returns the user's line kill character, or nil.
+*/
 static LUA_PROTO(c_killwchar)
-static LUA_PROTO(c_setcchar)
+{
+	wchar_t wc;
+	if (killwchar(&wc) == ERR)
+		return 0;
+	lc_pushwstr(L, &wc, 1);
+	return 1;
+}
+
+LUA_UNIMP(c_setcchar)
+
+/*
+* int curses.term_attrs()
+* Like termattrs(), for the WA_* attributes.
+*/
+static LUA_PROTO(c_term_attrs)
+{
+	lua_pushinteger(L, (lua_Integer)term_attrs());
+	return 1;
+}
+
+/*
+* bool curses.unget_wch(int/str ch)
+* Places a wide character back onto the input queue.
+*/
 static LUA_PROTO(c_unget_wch)
+{
+	lua_pushboolean(L, unget_wch(lc_checkwchar(L, 1)) != ERR);
+	return 1;
+}
+
+/*
+* str curses.wunctrl(int/str ch)
+* Like unctrl(), for a wide character.
+*/
 static LUA_PROTO(c_wunctrl)
+{
+	cchar_t cc;
+	wchar_t *rep;
+	lc_checkcchar(L, 1, 0, &cc);
+	rep = wunctrl(&cc);
+	if (rep)
+		lc_pushwstr(L, rep, -1);
+	else
+		lua_pushnil(L);
+	return 1;
+}
 #endif
 
 #ifdef LC_NCURSES
@@ -772,7 +1065,6 @@ static LUA_PROTO(c_extended_pair_content)
 static LUA_PROTO(c_extended_slk_color)
 static LUA_PROTO(c_find_pair)
 static LUA_PROTO(c_free_pair)
-static LUA_PROTO(c_getmouse)
 static LUA_PROTO(c_getsyx)
 static LUA_PROTO(c_has_key)
 static LUA_PROTO(c_init_extended_color)
@@ -782,13 +1074,10 @@ static LUA_PROTO(c_key_defined)
 static LUA_PROTO(c_keybound)
 static LUA_PROTO(c_keyok)
 static LUA_PROTO(c_mcprint)
-static LUA_PROTO(c_mouseinterval)
-static LUA_PROTO(c_mousemask)
 static LUA_PROTO(c_reset_color_pairs)
 static LUA_PROTO(c_resize_term)
 static LUA_PROTO(c_resizeterm)
 static LUA_PROTO(c_setsyx)
-static LUA_PROTO(c_ungetmouse)
 static LUA_PROTO(c_use_default_colors)
 static LUA_PROTO(c_use_extended_names)
 static LUA_PROTO(c_use_legacy_coding)
@@ -855,13 +1144,22 @@ static const luaL_Reg libfuncs[] = {
 	LCF(unctrl),
 	LCF(ungetch),
 	LCF(use_env),
+#ifdef NCURSES_MOUSE_VERSION
+	LCF(getmouse),
+	LCF(getmouse_all),
+	LCF(mouseinterval),
+	LCF(mousemask),
+	LCF(ungetmouse),
+#endif
 #ifdef LC_WIDE
 	LCF(erasewchar),
 	LCF(getcchar),
+	LCF(key_name),
 	LCF(killwchar),
 	LCF(setcchar),
 	LCF(term_attrs),
 	LCF(unget_wch),
+	LCF(wunctrl),
 #endif
 #ifdef LC_NCURSES
 	LCF(alloc_pair),
@@ -873,24 +1171,19 @@ static const luaL_Reg libfuncs[] = {
 	LCF(define_key),
 	LCF(find_pair),
 	LCF(free_pair),
-	LCF(getmouse),
 	LCF(getsyx),
 	LCF(has_key),
 	LCF(init_extended_color),
 	LCF(init_extended_pair),
 	LCF(is_term_resized),
 	LCF(key_defined),
-	LCF(key_name),
 	LCF(keybound),
 	LCF(keyok),
 	LCF(mcprint),
-	LCF(mouseinterval),
-	LCF(mousemask),
 	LCF(reset_color_pairs),
 	LCF(resize_term),
 	LCF(resizeterm),
 	LCF(setsyx),
-	LCF(ungetmouse),
 	LCF(use_default_colors),
 	LCF(use_extended_names),
 	LCF(use_legacy_coding),
@@ -900,16 +1193,20 @@ static const luaL_Reg libfuncs[] = {
 	{ NULL, NULL }
 };
 
-void lc_reg_lib(lua_State *L)
+/* every constant except the ACS_* ones, which only exist after initscr() */
+static const constpair lc_consts[] = {
+	#include "lc_const.h"
+	{ NULL, -1 }
+};
+
+/*
+* loads every constant and KEY_* code into the table on top of the stack.
+*/
+static void lc_loadconsts(lua_State *L)
 {
-	const constpair consts[] = {
-		#include "lc_const.h"
-		{ NULL, -1 }
-	};
-	constpair *cp = (constpair*)consts;
+	const constpair *cp = lc_consts;
 	int key;
 
-	/* load constants */
 	while (cp->key) {
 		lua_pushstring(L, cp->key);
 		lua_pushinteger(L, cp->val);
@@ -923,7 +1220,7 @@ void lc_reg_lib(lua_State *L)
 			while (key < KEY_F0 + 64) {
 				lua_pushfstring(L, "KEY_F%d", key - KEY_F0);
 				lua_pushinteger(L, key);
-				lua_settable(L, -3);
+				lua_rawset(L, -3);
 				key++;
 			}
 			continue;
@@ -937,6 +1234,103 @@ void lc_reg_lib(lua_State *L)
 		lua_pushinteger(L, key);
 		lua_setfield(L, -2, kname);
 	}
+}
+
+/*
+* void curses._loadconsts(table t)
+* Loads all constants into `t' (normally the curses table itself) at once,
+* for code that wants to iterate over it. Normally they're looked up on
+* first use.
+*/
+static LUA_PROTO(c__loadconsts)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_settop(L, 1);
+	lc_loadconsts(L);
+	return 0;
+}
+
+/* returns the code for a "KEY_*" name, or -1 */
+static int lc_keycode(const char *name)
+{
+	int key;
+
+	if (strncmp(name, "KEY_", 4))
+		return -1;
+
+	/* KEY_F0 .. KEY_F63 aren't named the same way by keyname() */
+	if (name[4] == 'F' && name[5] >= '0' && name[5] <= '9') {
+		const char *p = name + 5;
+		int n = 0;
+		while (*p >= '0' && *p <= '9' && n < 64)
+			n = n * 10 + (*p++ - '0');
+		if (*p == '\0' && n < 64 && (n == 0 || name[5] != '0'))
+			return KEY_F0 + n;
+	}
+
+	for (key = KEY_MIN; key <= KEY_MAX; key++) {
+		const char *kname;
+		if (key == KEY_F0) {
+			key += 63;
+			continue;
+		}
+		kname = keyname(key);
+		if (kname && !strcmp(kname, name))
+			return key;
+	}
+	return -1;
+}
+
+/*
+* curses.__index(table lib, str name)
+* Resolves constants and KEY_* codes the first time they're used and caches
+* them in the table. Building them all at load time costs a few hundred
+* keyname() calls and table inserts per require(). Only real constants are
+* cached, so looking up arbitrary names doesn't grow anything; names that
+* can't be constants (they all start with a capital) are turned away first.
+*/
+static LUA_PROTO(c___index)
+{
+	const constpair *cp;
+	const char *name;
+	lua_Integer val = -1;
+
+	if (lua_type(L, 2) != LUA_TSTRING)
+		return 0;
+	name = lua_tostring(L, 2);
+	if (*name < 'A' || *name > 'Z')
+		return 0;
+
+	for (cp = lc_consts; cp->key; cp++) {
+		if (!strcmp(cp->key, name)) {
+			val = cp->val;
+			break;
+		}
+	}
+	if (!cp->key) {
+		int key = lc_keycode(name);
+		if (key < 0)
+			return 0;
+		val = key;
+	}
+
+	lua_pushvalue(L, 2);
+	lua_pushinteger(L, val);
+	lua_rawset(L, 1);
+	lua_pushinteger(L, val);
+	return 1;
+}
+
+void lc_reg_lib(lua_State *L)
+{
+	/* constants are loaded on demand, see c___index */
+	lua_newtable(L);
+	lua_pushcfunction(L, c___index);
+	lua_setfield(L, -2, "__index");
+	lua_setmetatable(L, -2);
+
+	lua_pushcfunction(L, c__loadconsts);
+	lua_setfield(L, -2, "_loadconsts");
 
 	/* load curses.* funcs */
 	LC_REGISTER(L, libfuncs);
@@ -945,4 +1339,9 @@ void lc_reg_lib(lua_State *L)
 	lua_pushvalue(L, -1);
 	lua_pushcclosure(L, c_initscr, 1);
 	lua_setfield(L, -2, "initscr");
+
+	/* and bracketed_paste to set KEY_PASTE (in the same table) */
+	lua_pushvalue(L, -1);
+	lua_pushcclosure(L, c_bracketed_paste, 1);
+	lua_setfield(L, -2, "bracketed_paste");
 }
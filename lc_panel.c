@@ -15,14 +15,23 @@ static winhandle* lc_checknotpanel(lua_State *L, int narg)
 	return wh;
 }
 
-static winhandle* lc_findpanel(PANEL *p)
+/*
+* pushes a panel's window. every panel we create points back at its handle
+* via the panel userptr, but the panel stack is shared by every lua_State,
+* so another state's panel gets a borrowed handle of ours instead (which
+* doesn't delete the window, or know it's a panel). returns 0, pushing
+* nothing, for a panel luacurses didn't create.
+*/
+static int lc_pushpanel(lua_State *L, PANEL *p)
 {
-	winhandle *cur = lc_winlist;
-	if (!p)
-		return NULL;
-	while (cur && cur->pan != p)
-		cur = cur->hnext;
-	return cur;
+	winhandle *wh;
+	if (!p || !(wh = (winhandle*)panel_userptr(p)))
+		return 0;
+	if (lc_ownhandle(L, wh))
+		lc_pushhandle(L, wh);
+	else
+		lc_pushwindow(L, panel_window(p))->borrowed = 1;
+	return 1;
 }
 
 /*
@@ -34,6 +43,22 @@ static LUA_PROTO(c_update_panels)
 	return 0;
 }
 
+/*
+* table curses.panel_stack()
+* Returns every panel's window in a single array, from bottom to top.
+*/
+static LUA_PROTO(c_panel_stack)
+{
+	PANEL *p = NULL;
+	int i = 0;
+	lua_newtable(L);
+	while ((p = panel_above(p)) != NULL) {
+		if (lc_pushpanel(L, p))
+			lua_rawseti(L, -2, ++i);
+	}
+	return 1;
+}
+
 /*
 * bool window:new_panel()
 */
@@ -41,6 +66,8 @@ static LUA_PROTO(p_new_panel)
 {
 	winhandle *wh = lc_checknotpanel(L, 1);
 	wh->pan = new_panel(wh->win);
+	if (wh->pan)
+		set_panel_userptr(wh->pan, wh);
 	lua_pushboolean(L, wh->pan != NULL);
 	return 1;
 }
@@ -104,6 +131,7 @@ static LUA_PROTO(p_replace_panel)
 	if (replace_panel(wh->pan, wh2->win) != ERR) {
 		wh2->pan = wh->pan;
 		wh->pan = NULL;
+		set_panel_userptr(wh2->pan, wh2);
 		lua_pushboolean(L, 1);
 	} else {
 		lua_pushboolean(L, 0);
@@ -131,10 +159,7 @@ static LUA_PROTO(p_panel_hidden)
 static LUA_PROTO(p_panel_above)
 {
 	winhandle *wh = lc_checkpanel(L, 1);
-	winhandle *above = lc_findpanel(panel_above(wh->pan));
-	if (above)
-		lc_pushhandle(L, above);
-	else
+	if (!lc_pushpanel(L, panel_above(wh->pan)))
 		lua_pushnil(L);
 	return 1;
 }
@@ -142,10 +167,7 @@ static LUA_PROTO(p_panel_above)
 static LUA_PROTO(p_panel_below)
 {
 	winhandle *wh = lc_checkpanel(L, 1);
-	winhandle *below = lc_findpanel(panel_below(wh->pan));
-	if (below)
-		lc_pushhandle(L, below);
-	else
+	if (!lc_pushpanel(L, panel_below(wh->pan)))
 		lua_pushnil(L);
 	return 1;
 }
@@ -191,4 +213,7 @@ void lc_reg_panel(lua_State *L)
 	lua_pushcfunction(L, c_update_panels);
 	lua_setfield(L, -2, "update_panels");
 	lua_pop(L, 1);
+
+	lua_pushcfunction(L, c_panel_stack);
+	lua_setfield(L, -2, "panel_stack");
 }
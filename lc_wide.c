@@ -0,0 +1,132 @@
+#include "lc_wide.h"
+#include <string.h>
+#include <limits.h>
+#include <wchar.h>
+
+#ifdef LC_WIDE
+
+#define LC_BADCHAR 0xFFFD /* replacement character */
+
+#ifndef CCHARW_MAX
+#define CCHARW_MAX 5
+#endif
+
+/*
+* decodes one multibyte char at `s' into *wc and returns its length.
+* never fails: a bad or truncated sequence gives U+FFFD for its first byte.
+*/
+static size_t lc_decode(const char *s, size_t len, wchar_t *wc, mbstate_t *st)
+{
+	size_t r = mbrtowc(wc, s, len, st);
+	if (r == (size_t)-1 || r == (size_t)-2) {
+		*wc = LC_BADCHAR;
+		memset(st, 0, sizeof(*st));
+		return 1;
+	}
+	return r ? r : 1; /* embedded NUL */
+}
+
+wchar_t* lc_towstr(lua_State *L, const char *s, size_t len, size_t *n)
+{
+	wchar_t *ws = (wchar_t*)lc_scratch(L, (len + 1) * sizeof(wchar_t));
+	mbstate_t st;
+	size_t i, j;
+
+	/*
+	* 7-bit text is the same in every locale we care about, so it's widened
+	* as it's scanned. the decoder only takes over from the first byte >= 0x80.
+	*/
+	for (i = 0; i < len && (unsigned char)s[i] < 0x80; i++)
+		ws[i] = (unsigned char)s[i];
+	j = i;
+
+	if (i < len) {
+		memset(&st, 0, sizeof(st));
+		while (i < len) {
+			if ((unsigned char)s[i] < 0x80)
+				ws[j++] = (unsigned char)s[i++];
+			else
+				i += lc_decode(s + i, len - i, &ws[j++], &st);
+		}
+	}
+	ws[j] = 0;
+	*n = j;
+	return ws;
+}
+
+void lc_pushwstr(lua_State *L, const wchar_t *ws, int n)
+{
+	luaL_Buffer b;
+	char mb[MB_LEN_MAX];
+	mbstate_t st;
+	int i;
+
+	memset(&st, 0, sizeof(st));
+	luaL_buffinit(L, &b);
+	for (i = 0; (n < 0 || i < n) && ws[i]; i++) {
+		size_t r;
+		if ((unsigned long)ws[i] < 0x80) {
+			luaL_addchar(&b, (char)ws[i]);
+			continue;
+		}
+		r = wcrtomb(mb, ws[i], &st);
+		if (r == (size_t)-1) {
+			luaL_addchar(&b, '?');
+			memset(&st, 0, sizeof(st));
+		} else {
+			luaL_addlstring(&b, mb, r);
+		}
+	}
+	luaL_pushresult(&b);
+}
+
+wchar_t lc_checkwchar(lua_State *L, int narg)
+{
+	const char *s;
+	size_t len;
+	mbstate_t st;
+	wchar_t wc;
+
+	/* avoid automatic string <-> number conversion */
+	if (lua_type(L, narg) == LUA_TNUMBER)
+		return (wchar_t)lua_tointeger(L, narg);
+	if (lua_type(L, narg) != LUA_TSTRING)
+		luaL_typerror(L, narg, "number or string");
+
+	s = lua_tolstring(L, narg, &len);
+	luaL_argcheck(L, len > 0, narg, "empty string");
+	if ((unsigned char)*s < 0x80)
+		return (unsigned char)*s;
+	memset(&st, 0, sizeof(st));
+	lc_decode(s, len, &wc, &st);
+	return wc;
+}
+
+void lc_checkcchar(lua_State *L, int narg, int attrarg, cchar_t *cc)
+{
+	wchar_t wc[2];
+	attr_t attrs = 0;
+
+	wc[0] = lc_checkwchar(L, narg);
+	wc[1] = 0;
+	if (attrarg)
+		attrs = (attr_t)luaL_optnumber(L, attrarg, 0);
+	setcchar(cc, wc, attrs & ~A_COLOR, (short)PAIR_NUMBER(attrs), NULL);
+}
+
+void lc_pushcchar(lua_State *L, const cchar_t *cc)
+{
+	wchar_t wc[CCHARW_MAX + 1];
+	attr_t attrs;
+	short pair;
+
+	if (getcchar(cc, wc, &attrs, &pair, NULL) == ERR) {
+		wc[0] = 0;
+		attrs = 0;
+		pair = 0;
+	}
+	lc_pushwstr(L, wc, -1);
+	lua_pushinteger(L, attrs | COLOR_PAIR(pair));
+}
+
+#endif
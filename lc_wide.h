@@ -0,0 +1,35 @@
+#ifndef LC_WIDE_H
+#define LC_WIDE_H
+
+#include "luacurses.h"
+
+#ifdef LC_WIDE
+
+/*
+* conversions between Lua's UTF-8 strings and curses' wide characters.
+* non-ASCII text goes through mbrtowc()/wcrtomb(), so the program has to
+* have called os.setlocale("") (or picked a UTF-8 locale some other way).
+*/
+
+/*
+* decodes `len' bytes of `s' into a NUL-terminated wide string in the
+* scratch buffer, storing its length in *n. bad sequences become U+FFFD.
+* 7-bit text is just widened, without calling mbrtowc().
+*/
+wchar_t* lc_towstr(lua_State *L, const char *s, size_t len, size_t *n);
+
+/* pushes the first `n' chars of `ws' (or up to the NUL if n < 0) as UTF-8 */
+void lc_pushwstr(lua_State *L, const wchar_t *ws, int n);
+
+/* returns a code point, or the first character of a UTF-8 string */
+wchar_t lc_checkwchar(lua_State *L, int narg);
+
+/* makes a cchar_t from the char at narg, with the attributes at attrarg (if not 0) */
+void lc_checkcchar(lua_State *L, int narg, int attrarg, cchar_t *cc);
+
+/* pushes a cchar_t's text and attributes (including its color pair) */
+void lc_pushcchar(lua_State *L, const cchar_t *cc);
+
+#endif
+
+#endif
@@ -1,29 +1,198 @@
 #include "luacurses.h"
 #include "lc_window.h"
 #include "lc_chstr.h"
+#include "lc_winmap.h"
+#include "lc_wide.h"
 #include <stdlib.h>
 #include <string.h>
-
-winhandle *lc_winlist = NULL;
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
 
 winhandle* lc_findwindow(lua_State *L, WINDOW *w)
 {
-	winhandle *cur = lc_winlist;
-	if (!w)
-		return NULL;
-	while (cur && cur->win != w)
-		cur = cur->hnext;
-	return cur;
+	return lc_winmap_get(lc_getwinmap(L), w);
+}
+
+/*
+* winhandles are carved out of slabs allocated with the lua_Alloc of the
+* state that needs them, and go back on their slab's free list once their
+* last userdata is collected. a slab is released when it empties, unless
+* it's the only one left. each state has its own pool of slabs, and its own
+* window map, kept in a registry userdata whose __gc frees whatever is left
+* when the state closes.
+*/
+#define LC_SLABSIZE 32
+
+typedef struct lcpool {
+	struct lcslab *slabs;
+	lcwinmap map; /* this state's WINDOW* -> handle map */
+	lua_Alloc alloc;
+	void *ud;
+	int live, free, high; /* handle counts, see _handlestats() */
+} lcpool;
+
+typedef struct lcslab {
+	struct lcslab *next;
+	lcpool *pool;
+	winhandle *free; /* threaded through winhandle.next */
+	int used;
+	winhandle handles[LC_SLABSIZE];
+} lcslab;
+
+/* registry key of the pool userdata */
+static char lc_poolkey;
+
+static lcpool* lc_getpool(lua_State *L)
+{
+	lcpool *pool;
+	lua_pushlightuserdata(L, &lc_poolkey);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	pool = (lcpool*)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return pool;
+}
+
+lcwinmap* lc_getwinmap(lua_State *L)
+{
+	return &lc_getpool(L)->map;
+}
+
+int lc_ownhandle(lua_State *L, winhandle *wh)
+{
+	return wh->slab->pool == lc_getpool(L);
+}
+
+/*
+* the pool is created before any window userdata and finalizers run in
+* reverse order, so by the time it's collected every handle has been
+* given back and the slabs are empty. handles never leave their state
+* (the map is per state too), so nothing else can still point into them.
+*/
+static LUA_PROTO(lc_poolgc)
+{
+	lcpool *pool = (lcpool*)lua_touserdata(L, 1);
+	lc_winmap_free(&pool->map);
+	while (pool->slabs) {
+		lcslab *slab = pool->slabs;
+		pool->slabs = slab->next;
+		pool->alloc(pool->ud, slab, sizeof(lcslab), 0);
+	}
+	return 0;
+}
+
+static winhandle* lc_newhandle(lua_State *L)
+{
+	lcpool *pool = lc_getpool(L);
+	lcslab *slab;
+	winhandle *wh;
+
+	for (slab = pool->slabs; slab && !slab->free; slab = slab->next)
+		;
+
+	if (!slab) {
+		int i;
+
+		slab = pool->alloc(pool->ud, NULL, 0, sizeof(lcslab));
+		if (!slab)
+			luaL_error(L, "out of memory");
+		slab->pool = pool;
+		slab->used = 0;
+		slab->free = NULL;
+		for (i = LC_SLABSIZE - 1; i >= 0; i--) {
+			slab->handles[i].next = slab->free;
+			slab->free = &slab->handles[i];
+		}
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+		pool->free += LC_SLABSIZE;
+	}
+
+	wh = slab->free;
+	slab->free = wh->next;
+	slab->used++;
+
+	memset(wh, 0, sizeof(winhandle));
+	wh->slab = slab;
+	wh->parentref = LUA_NOREF;
+	wh->delay = -1;
+
+	pool->free--;
+	if (++pool->live > pool->high)
+		pool->high = pool->live;
+	return wh;
+}
+
+static void lc_freehandle(winhandle *wh)
+{
+	lcslab *slab = wh->slab;
+	lcpool *pool = slab->pool;
+
+	wh->next = slab->free;
+	slab->free = wh;
+	slab->used--;
+	pool->live--;
+	pool->free++;
+
+	if (slab->used == 0 && (slab != pool->slabs || slab->next)) {
+		lcslab **cur = &pool->slabs;
+		while (*cur != slab)
+			cur = &(*cur)->next;
+		*cur = slab->next;
+		pool->free -= LC_SLABSIZE;
+		pool->alloc(pool->ud, slab, sizeof(lcslab), 0);
+	}
+}
+
+/*
+* int live, int free, int highwater = curses._handlestats()
+* Debugging aid: reports how many window handles are in use, how many
+* are allocated but unused, and the most ever in use at once.
+*/
+static LUA_PROTO(c__handlestats)
+{
+	lcpool *pool = lc_getpool(L);
+	lua_pushinteger(L, pool->live);
+	lua_pushinteger(L, pool->free);
+	lua_pushinteger(L, pool->high);
+	return 3;
 }
 
+char lc_windowkey;
+
+/* registry key of the weak table mapping handles to their userdata */
+static char lc_proxies;
+
 winhandle* lc_pushhandle(lua_State *L, winhandle *wh)
 {
-	winhandle **whptr = lua_newuserdata(L, sizeof(winhandle*));
+	winhandle **whptr;
+
+	/* every handle has at most one userdata, reuse it while it's alive */
+	lua_pushlightuserdata(L, &lc_proxies);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	lua_pushlightuserdata(L, wh);
+	lua_rawget(L, -2);
+	if (!lua_isnil(L, -1)) {
+		lua_remove(L, -2);
+		return wh;
+	}
+	lua_pop(L, 1);
+
+	whptr = lua_newuserdata(L, sizeof(winhandle*));
 	*whptr = wh;
-	luaL_setmetatable(L, LC_WINDOWMT);
+	lc_setmetatable(L, &lc_windowkey);
 
+	/*
+	* refs counts userdata, not pushes. it can still briefly be 2 if we're
+	* pushed again after the old userdata died but before its __gc ran.
+	*/
 	wh->refs += 1;
 
+	lua_pushlightuserdata(L, wh);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, -4);
+	lua_remove(L, -2);
+
 	return wh;
 }
 
@@ -38,20 +207,30 @@ winhandle* lc_pushwindow(lua_State *L, WINDOW *w)
 
 	wh = lc_findwindow(L, w);
 	if (!wh) {
-		wh = memset(malloc(sizeof(winhandle)), 0, sizeof(winhandle));
+		wh = lc_newhandle(L);
 		wh->win = w;
 
-		wh->hnext = lc_winlist;
-		lc_winlist = wh;
+		/* curses owns stdscr, and every state shares it */
+		wh->borrowed = (w == stdscr);
+
+		if (!lc_winmap_put(lc_getwinmap(L), wh)) {
+			lc_freehandle(wh);
+			luaL_error(L, "out of memory");
+		}
 	}
 
 	return lc_pushhandle(L, wh);
 }
 
+winhandle* lc_tohandle(lua_State *L, int narg)
+{
+	return *((winhandle**)lc_checkudata(L, narg, &lc_windowkey, LC_WINDOWMT));
+}
+
 winhandle* lc_checkhandle(lua_State *L, int narg)
 {
-	winhandle *wh = *((winhandle**)luaL_checkudata(L, narg, LC_WINDOWMT));
-	luaL_argcheck(L, narg, wh->win != NULL, "invalid window");
+	winhandle *wh = lc_tohandle(L, narg);
+	luaL_argcheck(L, wh->win != NULL, narg, "invalid window");
 	return wh;
 }
 
@@ -60,101 +239,277 @@ WINDOW* lc_checkwindow(lua_State *L, int narg)
 	return lc_checkhandle(L, narg)->win;
 }
 
+/* adds `wh' to the front of `parent''s list of subwindows */
+void lc_linkhandle(lua_State *L, int narg, winhandle *wh)
+{
+	winhandle *parent = lc_tohandle(L, narg);
+
+	lua_pushvalue(L, narg);
+	luaL_unref(L, LUA_REGISTRYINDEX, wh->parentref);
+	wh->parentref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	wh->parent = parent;
+	wh->prev = NULL;
+	wh->next = parent->sub;
+	if (parent->sub)
+		parent->sub->prev = wh;
+	parent->sub = wh;
+}
+
+/* removes `wh' from its parent's list of subwindows, if it's in one */
+static void lc_unlinkhandle(winhandle *wh)
+{
+	if (wh->prev)
+		wh->prev->next = wh->next;
+	else if (wh->parent)
+		wh->parent->sub = wh->next;
+	if (wh->next)
+		wh->next->prev = wh->prev;
+	wh->parent = wh->prev = wh->next = NULL;
+}
+
+/* deletes a single handle's window, which must have no subwindows left */
+static int lc_delhandle(winhandle *wh)
+{
+	int rv;
+
+	if (wh->shadow) {
+		free(wh->shadow);
+		wh->shadow = NULL;
+	}
+
+	/* the panel's userptr points at us, and we may be freed after this */
+	if (wh->pan) {
+		del_panel(wh->pan);
+		wh->pan = NULL;
+	}
+
+	/*
+	* NOTE: we yank it from the window map here rather than in __gc, because
+	* the map is keyed on the WINDOW* and curses may hand the same address
+	* out again for a new window.
+	*/
+	lc_winmap_del(&wh->slab->pool->map, wh->win);
+	rv = wh->borrowed ? OK : delwin(wh->win);
+	wh->win = NULL;
+	return rv != ERR;
+}
+
 /*
 * deletes the underlying WINDOW* and sets the 'win' ptr to NULL for the
 * given handle and all of its subhandles (will fail if any subwindows
 * weren't created by luacurses).
-* returns true if delwin() returned OK or if the window was already deleted.
+* the tree is torn down bottom-up without recursion, so deep nesting can't
+* overflow the C stack. if `count' isn't NULL it gets the number of windows
+* deleted.
+* returns true if every delwin() returned OK or if the window was already
+* deleted.
 */
-int lc_close_handle(winhandle *wh, int top)
+int lc_close_tree(winhandle *wh, int *count)
 {
-	winhandle *cur;
+	winhandle *cur = wh;
+	int ok = 1, n = 0;
+
+	if (count)
+		*count = 0;
 
 	/* if we're already dead, stop here */
 	if (!wh->win)
 		return 1;
 
-	/*
-	* NOTE: we do NOT yank it from the window list here, because that would
-	* cause a duplicate winhandle struct if the WINDOW* is ever pushed again.
-	* we yank it in __gc when all other refs are dead.
-	*/
+	/* detach from our parent so the walk below stops at us */
+	lc_unlinkhandle(wh);
+
+	for (;;) {
+		winhandle *parent;
+
+		/* the first leaf below cur; its subwindows are all gone */
+		while (cur->sub)
+			cur = cur->sub;
+
+		parent = cur->parent;
+		lc_unlinkhandle(cur);
+		if (!lc_delhandle(cur))
+			ok = 0;
+		n++;
 
-	/* kill subwindows first */
-	cur = wh->sub;
-	while (cur) {
-		lc_close_handle(cur, 0);
-		cur = cur->next;
+		if (cur == wh)
+			break;
+		cur = parent;
 	}
-	wh->sub = NULL;
 
-	/*
-	* if we're being called recursively we're looping through a list of
-	* subwindows so we don't really give a shit about closing the gap in
-	* the list.
-	* if this is the first time we were called, we do need to close it.
-	*/
-	if (top && wh->parent) {
-		cur = wh->parent->sub;
-		if (cur == wh) {
-			wh->parent->sub = cur->next;
-		} else {
-			/* find ourselves in the list */
-			while (cur) {
-				if (cur->next == wh) {
-					cur->next = wh->next;
-					break;
-				}
-				cur = cur->next;
-			}
-		}
+	if (count)
+		*count = n;
+	return ok;
+}
+
+/*
+* (re)allocates the handle's shadow to match the window size. the shadow is
+* zeroed, so the next diff sees every row as changed. there's one row (plus
+* the terminator curses writes after it) of scratch space past the end for
+* reading back in.
+*/
+static int lc_resetshadow(winhandle *wh)
+{
+	int h, w;
+	getmaxyx(wh->win, h, w);
+	free(wh->shadow);
+	wh->shadow = calloc((size_t)(h + 1) * w + 1, sizeof(lccell));
+	wh->shadowh = h;
+	wh->shadoww = w;
+	return wh->shadow != NULL;
+}
+
+/*
+* forgets `n' rows of the shadow from `start', so the next diff treats them
+* as changed and leaves them touched. used when the caller touches or
+* redraws rows, e.g. to repaint what an overlapping window covered.
+*/
+static void lc_forgetrows(winhandle *wh, int start, int n)
+{
+	if (!wh->shadow)
+		return;
+	if (start < 0) {
+		n += start;
+		start = 0;
 	}
+	if (n > wh->shadowh - start)
+		n = wh->shadowh - start;
+	if (n > 0)
+		memset(wh->shadow + (size_t)start * wh->shadoww, 0,
+			(size_t)n * wh->shadoww * sizeof(lccell));
+}
+
+/* estimated output for a cursor move and an attribute change (CUP, SGR) */
+#define LC_MOVEBYTES 8
+#define LC_ATTRBYTES 8
+
+/*
+* compares the window against its shadow before a refresh. rows that didn't
+* change are untouched so curses skips them; the changed span of every other
+* row is copied into the shadow.
+*/
+static void lc_diffshadow(winhandle *wh)
+{
+	WINDOW *w = wh->win;
+	int h, width, y, x, cy, cx;
+	lccell *row;
 
-	if (wh->win) {
-		int rv = delwin(wh->win);
-		wh->win = NULL;
-		return rv != ERR;
+	getmaxyx(w, h, width);
+	if (h != wh->shadowh || width != wh->shadoww) {
+		if (!lc_resetshadow(wh))
+			return;
 	}
 
-	return 1;
+	wh->statcells = 0;
+	wh->statrows = 0;
+	wh->statbytes = 0;
+	row = wh->shadow + h * width;
+
+	getyx(w, cy, cx);
+	for (y = 0; y < h; y++) {
+		lccell *sh = wh->shadow + y * width;
+		int first = 0, last;
+		attr_t attr = A_NORMAL;
+
+		lc_mvwincells(w, y, 0, row, width);
+		while (first < width && LC_CELLEQ(row[first], sh[first]))
+			first++;
+		if (first == width) {
+			wtouchln(w, y, 1, 0);
+			continue;
+		}
+
+		last = width - 1;
+		while (LC_CELLEQ(row[last], sh[last]))
+			last--;
+		memcpy(sh + first, row + first, (last - first + 1) * sizeof(lccell));
+
+		wh->statcells += last - first + 1;
+		wh->statrows++;
+		wh->statbytes += LC_MOVEBYTES;
+		for (x = first; x <= last; x++) {
+			if ((attr_t)LC_CELLATTR(row[x]) != attr) {
+				attr = LC_CELLATTR(row[x]);
+				wh->statbytes += LC_ATTRBYTES;
+			}
+			wh->statbytes += LC_CELLBYTES(row[x]);
+		}
+	}
+	wmove(w, cy, cx);
 }
 
-int lc_checkmv(lua_State *L, WINDOW *w, int pushnil)
+int lc_checkmv(lua_State *L, WINDOW *w, int narg, int pushnil)
 {
-	if (lua_type(L, 2) != LUA_TNUMBER || lua_type(L, 3) != LUA_TNUMBER)
+	if (lua_type(L, narg) != LUA_TNUMBER || lua_type(L, narg + 1) != LUA_TNUMBER)
 		return 1;
-	if (wmove(w, luaL_checkint(L, 2), luaL_checkint(L, 3)) == ERR) {
+	if (wmove(w, luaL_checkint(L, narg), luaL_checkint(L, narg + 1)) == ERR) {
 		if (pushnil)
 			lua_pushnil(L);
 		else
 			lua_pushboolean(L, 0);
 		return 0;
 	}
-	lua_remove(L, 2);
-	lua_remove(L, 2);
+	lua_remove(L, narg);
+	lua_remove(L, narg);
 	return 1;
 }
 
+/*
+* stdscr's handle for the curses.addstr() etc. shortcuts. upvalue 1 is an
+* lcstdscr box shared by all of them, which keeps stdscr's userdata alive
+* and is only refilled when stdscr changes (initscr() again, newterm()).
+*/
+typedef struct lcstdscr {
+	winhandle *wh;
+	int ref;
+} lcstdscr;
+
+static winhandle* lc_stdscrhandle(lua_State *L)
+{
+	lcstdscr *box = (lcstdscr*)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (box->wh && box->wh->win == stdscr && stdscr)
+		return box->wh;
+	if (!lc_initonce || !stdscr)
+		luaL_error(L, "must call initscr() first");
+	box->wh = lc_pushwindow(L, stdscr);
+	luaL_unref(L, LUA_REGISTRYINDEX, box->ref);
+	box->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	return box->wh;
+}
+
+/*
+* window methods that also have a stdscr shortcut are written once against
+* `wh' and `a', the index of their first argument after the window, so the
+* shortcut can hand over stdscr without shifting the stack.
+*/
+#define LC_WFN(fn) \
+	static int lc_ ## fn(lua_State *L, winhandle *wh, int a); \
+	static LUA_PROTO(w_ ## fn) { return lc_ ## fn(L, lc_checkhandle(L, 1), 2); } \
+	static LUA_PROTO(s_ ## fn) { return lc_ ## fn(L, lc_stdscrhandle(L), 1); } \
+	static int lc_ ## fn(lua_State *L, winhandle *wh, int a)
+
 /*
 * bool window:addch([int y, int x,] int/char ch)
 * Adds the given character to the window at the cursor position.
 * Accepts a number or string.
 */
-static LUA_PROTO(w_addch)
+LC_WFN(addch)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	chtype ch;
 
-	if (!lc_checkmv(L, w, 0))
+	if (!lc_checkmv(L, w, a, 0))
 		return 1;
 
 	/* avoid automatic string <-> number conversion */
-	if (lua_type(L, 2) == LUA_TNUMBER)
-		ch = lua_tointeger(L, 2);
-	else if (lua_type(L, 2) == LUA_TSTRING)
-		ch = *luaL_checkstring(L, 2);
+	if (lua_type(L, a) == LUA_TNUMBER)
+		ch = lua_tointeger(L, a);
+	else if (lua_type(L, a) == LUA_TSTRING)
+		ch = *luaL_checkstring(L, a);
 	else
-		luaL_typerror(L, 2, "number or string");
+		return luaL_typerror(L, a, "number or string");
 
 	lua_pushboolean(L, waddch(w, ch) != ERR);
 	return 1;
@@ -162,22 +517,23 @@ static LUA_PROTO(w_addch)
 
 /*
 * bool window:addchstr([int y, int x,] chstr, n = -1)
-* Adds a chtype array to the window, created with curses.chstr(),
-* truncating at EOL.
+* Adds a chtype array to the window, created with curses.chstr() or
+* chstr:sub(), truncating at EOL.
 * If n is specified, only writes n chars.
 */
 LUA_PROTO(w_addchstr)
 {
 	WINDOW *w = lc_checkwindow(L, 1);
-	int rv;
+	int rv, n;
 	chstr *cs;
-	if (!lc_checkmv(L, w, 0))
+	if (!lc_checkmv(L, w, 2, 0))
 		return 1;
 	cs = lc_checkchstr(L, 2);
-	if (!lua_isnoneornil(L, 3))
-		rv = waddchnstr(w, cs->str, luaL_checkint(L, 3));
-	else
-		rv = waddchstr(w, cs->str);
+	n = luaL_optint(L, 3, -1);
+	/* views aren't NUL-terminated, so never read past the end */
+	if (n < 0 || n > (int)cs->len)
+		n = cs->len;
+	rv = waddchnstr(w, LC_CHSTR_STR(cs), n);
 	lua_pushboolean(L, rv != ERR);
 	return 1;
 }
@@ -187,28 +543,81 @@ LUA_PROTO(w_addchstr)
 * Adds a string to the window, wrapping at EOL.
 * If n is specified, only writes n chars.
 */
-static LUA_PROTO(w_addstr)
+LC_WFN(addstr)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	int rv;
-	if (!lc_checkmv(L, w, 0))
+	if (!lc_checkmv(L, w, a, 0))
 		return 1;
-	if (!lua_isnoneornil(L, 3))
-		rv = waddnstr(w, luaL_checkstring(L, 2), luaL_checkint(L, 3));
+	if (!lua_isnoneornil(L, a + 1))
+		rv = waddnstr(w, luaL_checkstring(L, a), luaL_checkint(L, a + 1));
 	else
-		rv = waddstr(w, luaL_checkstring(L, 2));
+		rv = waddstr(w, luaL_checkstring(L, a));
 	lua_pushboolean(L, rv != ERR);
 	return 1;
 }
 
+/*
+* bool window:addch_at(int y, int x, int/char ch)
+* bool window:addchstr_at(int y, int x, chstr, [int n])
+* bool window:addstr_at(int y, int x, str, [int n])
+* Same as addch() etc. with a move, but the coordinates are required, so
+* the arguments are read in place instead of being probed and shifted.
+* curses.addch_at() etc. write to stdscr the same way, without inserting it.
+*/
+LC_WFN(addch_at)
+{
+	WINDOW *w = wh->win;
+	int y = luaL_checkint(L, a);
+	int x = luaL_checkint(L, a + 1);
+	chtype ch = 0;
+
+	if (lua_type(L, a + 2) == LUA_TNUMBER)
+		ch = lua_tointeger(L, a + 2);
+	else if (lua_type(L, a + 2) == LUA_TSTRING)
+		ch = *lua_tostring(L, a + 2);
+	else
+		luaL_typerror(L, a + 2, "number or string");
+
+	lua_pushboolean(L, mvwaddch(w, y, x, ch) != ERR);
+	return 1;
+}
+
+LC_WFN(addchstr_at)
+{
+	WINDOW *w = wh->win;
+	int y = luaL_checkint(L, a);
+	int x = luaL_checkint(L, a + 1);
+	chstr *cs = lc_checkchstr(L, a + 2);
+	int n = luaL_optint(L, a + 3, -1);
+	if (n < 0 || n > (int)cs->len)
+		n = cs->len;
+	lua_pushboolean(L, mvwaddchnstr(w, y, x, LC_CHSTR_STR(cs), n) != ERR);
+	return 1;
+}
+
+LC_WFN(addstr_at)
+{
+	WINDOW *w = wh->win;
+	int y = luaL_checkint(L, a);
+	int x = luaL_checkint(L, a + 1);
+	size_t len;
+	const char *str = luaL_checklstring(L, a + 2, &len);
+	int n = luaL_optint(L, a + 3, -1);
+	if (n < 0 || n > (int)len)
+		n = len;
+	lua_pushboolean(L, mvwaddnstr(w, y, x, str, n) != ERR);
+	return 1;
+}
+
 /*
 * int attrs, pair = window:attr_get()
 */
-static LUA_PROTO(w_attr_get)
+LC_WFN(attr_get)
 {
 	attr_t attrs = -1;
 	short pair = -1;
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	if (wattr_get(w, &attrs, &pair, NULL) == ERR) {
 		lua_pushnil(L);
 		return 1;
@@ -222,10 +631,10 @@ static LUA_PROTO(w_attr_get)
 * bool window:attr_off(int attrs)
 * Disables the given attributes.
 */
-static LUA_PROTO(w_attr_off)
+LC_WFN(attr_off)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	attr_t attrs = luaL_checkint(L, 2);
+	WINDOW *w = wh->win;
+	attr_t attrs = luaL_checkint(L, a);
 	lua_pushboolean(L, wattr_off(w, attrs, NULL) != ERR);
 	return 1;
 }
@@ -234,10 +643,10 @@ static LUA_PROTO(w_attr_off)
 * bool window:attr_on(int attrs)
 * Enables the given attributes.
 */
-static LUA_PROTO(w_attr_on)
+LC_WFN(attr_on)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	attr_t attrs = luaL_checkint(L, 2);
+	WINDOW *w = wh->win;
+	attr_t attrs = luaL_checkint(L, a);
 	lua_pushboolean(L, wattr_on(w, attrs, NULL) != ERR);
 	return 1;
 }
@@ -246,11 +655,11 @@ static LUA_PROTO(w_attr_on)
 * bool window:attr_set(int attrs, int pair)
 * Set the window's attributes and color, overriding the previous.
 */
-static LUA_PROTO(w_attr_set)
+LC_WFN(attr_set)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	attr_t attrs = luaL_checkint(L, 2);
-	short pair = luaL_checkint(L, 3);
+	WINDOW *w = wh->win;
+	attr_t attrs = luaL_checkint(L, a);
+	short pair = luaL_checkint(L, a + 1);
 	lua_pushboolean(L, wattr_set(w, attrs, pair, NULL) != ERR);
 	return 1;
 }
@@ -259,10 +668,10 @@ static LUA_PROTO(w_attr_set)
 * bool window:attroff(int attr)
 * Disables the given attributes, which may be OR'd with a color pair under 256.
 */
-static LUA_PROTO(w_attroff)
+LC_WFN(attroff)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int attrs = luaL_checkint(L, 2);
+	WINDOW *w = wh->win;
+	int attrs = luaL_checkint(L, a);
 	lua_pushboolean(L, wattroff(w, attrs) != ERR);
 	return 1;
 }
@@ -271,10 +680,10 @@ static LUA_PROTO(w_attroff)
 * bool window:attron(int attr)
 * Enables the given attributes, which may be OR'd with a color pair under 256.
 */
-static LUA_PROTO(w_attron)
+LC_WFN(attron)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int attrs = luaL_checkint(L, 2);
+	WINDOW *w = wh->win;
+	int attrs = luaL_checkint(L, a);
 	lua_pushboolean(L, wattron(w, attrs) != ERR);
 	return 1;
 }
@@ -284,24 +693,149 @@ static LUA_PROTO(w_attron)
 * Sets the given attributes, which may be OR'd with a color pair under 256,
 * and overrides anything previous.
 */
-static LUA_PROTO(w_attrset)
+LC_WFN(attrset)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int attrs = luaL_checkint(L, 2);
+	WINDOW *w = wh->win;
+	int attrs = luaL_checkint(L, a);
 	lua_pushboolean(L, wattrset(w, attrs) != ERR);
 	return 1;
 }
 
+/* argument of a batch() command at cmds[i], checked against the table index */
+static lua_Integer lc_batchint(lua_State *L, int i)
+{
+	lua_Integer n;
+	lua_rawgeti(L, 2, i);
+	if (lua_type(L, -1) != LUA_TNUMBER)
+		luaL_error(L, "batch: number expected at index %d", i);
+	n = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	return n;
+}
+
+static chtype lc_batchchar(lua_State *L, int i)
+{
+	chtype ch = 0;
+	lua_rawgeti(L, 2, i);
+	if (lua_type(L, -1) == LUA_TNUMBER)
+		ch = lua_tointeger(L, -1);
+	else if (lua_type(L, -1) == LUA_TSTRING)
+		ch = *lua_tostring(L, -1);
+	else
+		luaL_error(L, "batch: number or string expected at index %d", i);
+	lua_pop(L, 1);
+	return ch;
+}
+
+/*
+* bool[, int] window:batch(table cmds)
+* Runs a flat array of drawing commands against the window in one call:
+*   win:batch{ "move", 0, 0, "attron", A_BOLD, "addstr", "hi", "attroff", A_BOLD }
+* Commands and their arguments:
+*   move y x | addch ch | addstr str | addchstr chstr
+*   attron a | attroff a | attrset a | hline ch n | vline ch n
+* Returns true, or false and the index of the first command that failed.
+* Failed commands don't stop the batch, same as separate calls.
+*/
+static LUA_PROTO(w_batch)
+{
+	WINDOW *w = lc_checkwindow(L, 1);
+	int i = 1, n, bad = 0;
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	n = LC_RAWLEN(L, 2);
+
+	while (i <= n) {
+		int cmd = i, rv = ERR;
+		const char *op;
+		size_t len;
+
+		lua_rawgeti(L, 2, i++);
+		if (lua_type(L, -1) != LUA_TSTRING)
+			return luaL_error(L, "batch: command expected at index %d", cmd);
+		op = lua_tostring(L, -1);
+		lua_pop(L, 1); /* still referenced from cmds */
+
+		switch (op[0]) {
+		case 'a':
+			if (!strcmp(op, "addstr")) {
+				const char *str;
+				lua_rawgeti(L, 2, i);
+				if (lua_type(L, -1) != LUA_TSTRING)
+					return luaL_error(L, "batch: string expected at index %d", i);
+				str = lua_tolstring(L, -1, &len);
+				rv = waddnstr(w, str, len);
+				lua_pop(L, 1);
+				i++;
+				break;
+			} else if (!strcmp(op, "addch")) {
+				rv = waddch(w, lc_batchchar(L, i++));
+				break;
+			} else if (!strcmp(op, "addchstr")) {
+				chstr *cs;
+				lua_rawgeti(L, 2, i);
+				cs = lc_testudata(L, -1, &lc_chstrkey);
+				if (!cs)
+					return luaL_error(L, "batch: chstr expected at index %d", i);
+				rv = waddchnstr(w, LC_CHSTR_STR(cs), cs->len);
+				lua_pop(L, 1);
+				i++;
+				break;
+			} else if (!strcmp(op, "attron")) {
+				rv = wattron(w, lc_batchint(L, i++));
+				break;
+			} else if (!strcmp(op, "attroff")) {
+				rv = wattroff(w, lc_batchint(L, i++));
+				break;
+			} else if (!strcmp(op, "attrset")) {
+				rv = wattrset(w, lc_batchint(L, i++));
+				break;
+			}
+			goto unknown;
+		case 'm':
+			if (!strcmp(op, "move")) {
+				int y = lc_batchint(L, i++);
+				rv = wmove(w, y, lc_batchint(L, i++));
+				break;
+			}
+			goto unknown;
+		case 'h':
+		case 'v':
+			if (!strcmp(op + 1, "line")) {
+				chtype ch = lc_batchchar(L, i++);
+				int cnt = lc_batchint(L, i++);
+				rv = op[0] == 'h' ? whline(w, ch, cnt) : wvline(w, ch, cnt);
+				break;
+			}
+			/* fall through */
+		default:
+		unknown:
+			return luaL_error(L, "batch: unknown command '%s' at index %d", op, cmd);
+		}
+
+		if (rv == ERR && !bad)
+			bad = cmd;
+	}
+
+	if (bad) {
+		lua_pushboolean(L, 0);
+		lua_pushinteger(L, bad);
+		return 2;
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
 /*
 * bool window:bkgd(int ch)
 * Sets the background char and attributes of the window.
 * The new char replaces the old one where it appears.
 * The attributes apply to any chars subsequently written with addch().
 */
-static LUA_PROTO(w_bkgd)
+LC_WFN(bkgd)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	chtype ch = luaL_checkchar(L, 2);
+	WINDOW *w = wh->win;
+	chtype ch = luaL_checkchar(L, a);
 	lua_pushboolean(L, wbkgd(w, ch) != ERR);
 	return 1;
 }
@@ -312,10 +846,10 @@ static LUA_PROTO(w_bkgd)
 * The new char and attributes apply to any chars subsequently written
 * with addch().
 */
-static LUA_PROTO(w_bkgdset)
+LC_WFN(bkgdset)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	chtype ch = luaL_checkchar(L, 2);
+	WINDOW *w = wh->win;
+	chtype ch = luaL_checkchar(L, a);
 	wbkgd(w, ch);
 	return 1;
 }
@@ -323,19 +857,19 @@ static LUA_PROTO(w_bkgdset)
 /*
 * Draws a box around the edges of the window.
 */
-static LUA_PROTO(w_border)
+LC_WFN(border)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	lua_pushboolean(L, wborder(
 		w,
-		luaL_optint(L, 2, 0),
-		luaL_optint(L, 3, 0),
-		luaL_optint(L, 4, 0),
-		luaL_optint(L, 5, 0),
-		luaL_optint(L, 6, 0),
-		luaL_optint(L, 7, 0),
-		luaL_optint(L, 8, 0),
-		luaL_optint(L, 9, 0)
+		luaL_optint(L, a, 0),
+		luaL_optint(L, a + 1, 0),
+		luaL_optint(L, a + 2, 0),
+		luaL_optint(L, a + 3, 0),
+		luaL_optint(L, a + 4, 0),
+		luaL_optint(L, a + 5, 0),
+		luaL_optint(L, a + 6, 0),
+		luaL_optint(L, a + 7, 0)
 	) != ERR);
 	return 1;
 }
@@ -343,27 +877,27 @@ static LUA_PROTO(w_border)
 /*
 * Draws a box around the edges of the window.
 */
-static LUA_PROTO(w_box)
+LC_WFN(box)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	lua_pushboolean(L, box(w, luaL_optint(L, 2, 0), luaL_optint(L, 3, 0)) != ERR);
+	WINDOW *w = wh->win;
+	lua_pushboolean(L, box(w, luaL_optint(L, a, 0), luaL_optint(L, a + 1, 0)) != ERR);
 	return 1;
 }
 
 /*
 * bool window:chgat([int x, int y,] int n, int attr, int pair)
 */
-static LUA_PROTO(w_chgat)
+LC_WFN(chgat)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	int n;
 	attr_t attr;
 	short pair;
-	if (!lc_checkmv(L, w, 0))
+	if (!lc_checkmv(L, w, a, 0))
 		return 1;
-	n = luaL_checkint(L, 2);
-	attr = luaL_checkint(L, 3);
-	pair = luaL_checkint(L, 4);
+	n = luaL_checkint(L, a);
+	attr = luaL_checkint(L, a + 1);
+	pair = luaL_checkint(L, a + 2);
 	lua_pushboolean(L, wchgat(w, n, attr, pair, NULL) != ERR);
 	return 1;
 }
@@ -371,9 +905,9 @@ static LUA_PROTO(w_chgat)
 /*
 * bool window:clear()
 */
-static LUA_PROTO(w_clear)
+LC_WFN(clear)
 {
-	lua_pushboolean(L, wclear(lc_checkwindow(L, 1)) != ERR);
+	lua_pushboolean(L, wclear(wh->win) != ERR);
 	return 1;
 }
 
@@ -394,18 +928,49 @@ static LUA_PROTO(w_clearok)
 /*
 * bool window:clrtobot()
 */
-static LUA_PROTO(w_clrtobot)
+LC_WFN(clrtobot)
 {
-	lua_pushboolean(L, wclrtobot(lc_checkwindow(L, 1)) != ERR);
+	lua_pushboolean(L, wclrtobot(wh->win) != ERR);
 	return 1;
 }
 
 /*
 * bool window:clrtoeol()
 */
-static LUA_PROTO(w_clrtoeol)
+LC_WFN(clrtoeol)
+{
+	lua_pushboolean(L, wclrtoeol(wh->win) != ERR);
+	return 1;
+}
+
+/*
+* bool window:close()
+* Deletes the window and its subwindows right away, like delwin(), but
+* doesn't complain if that already happened. Also serves as __close, so
+*   local w <close> = curses.newwin(...)
+* deletes the window when `w' goes out of scope in Lua 5.4.
+*/
+static LUA_PROTO(w_close)
+{
+	winhandle *wh = lc_tohandle(L, 1);
+	lua_pushboolean(L, lc_closehandle(wh));
+	return 1;
+}
+
+/*
+* int window:close_tree()
+* Like close(), but returns the number of windows that were deleted
+* (the window itself plus all of its subwindows), or false if curses
+* failed to delete any of them.
+*/
+static LUA_PROTO(w_close_tree)
 {
-	lua_pushboolean(L, wclrtoeol(lc_checkwindow(L, 1)) != ERR);
+	winhandle *wh = lc_tohandle(L, 1);
+	int n;
+	if (lc_close_tree(wh, &n))
+		lua_pushinteger(L, n);
+	else
+		lua_pushboolean(L, 0);
 	return 1;
 }
 
@@ -457,10 +1022,10 @@ static LUA_PROTO(w_cursyncup)
 /*
 * bool window:delch([int x, int y])
 */
-static LUA_PROTO(w_delch)
+LC_WFN(delch)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	if (lc_checkmv(L, w, 0))
+	WINDOW *w = wh->win;
+	if (lc_checkmv(L, w, a, 0))
 		lua_pushboolean(L, wdelch(w) != ERR);
 	return 1;
 }
@@ -468,9 +1033,9 @@ static LUA_PROTO(w_delch)
 /*
 * bool window:deleteln()
 */
-static LUA_PROTO(w_deleteln)
+LC_WFN(deleteln)
 {
-	lua_pushboolean(L, wdeleteln(lc_checkwindow(L, 1)) != ERR);
+	lua_pushboolean(L, wdeleteln(wh->win) != ERR);
 	return 1;
 }
 
@@ -494,13 +1059,14 @@ static LUA_PROTO(w_delwin)
 */
 static LUA_PROTO(w_derwin)
 {
+	winhandle *wh = lc_checkhandle(L, 1);
 	WINDOW *dw = derwin(
-		lc_checkwindow(L, 1),
+		wh->win,
 		luaL_checkint(L, 2), luaL_checkint(L, 3),
 		luaL_checkint(L, 4), luaL_checkint(L, 5)
 	);
 	if (dw) {
-		lc_pushwindow(L, dw);
+		lc_linkhandle(L, 1, lc_pushwindow(L, dw));
 	} else {
 		lua_pushnil(L);
 	}
@@ -525,10 +1091,10 @@ static LUA_PROTO(w_dupwin)
 /*
 * bool window:echochar()
 */
-static LUA_PROTO(w_echochar)
+LC_WFN(echochar)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	chtype ch = luaL_checkint(L, 2);
+	WINDOW *w = wh->win;
+	chtype ch = luaL_checkint(L, a);
 	lua_pushboolean(L, wechochar(w, ch) != ERR);
 	return 1;
 }
@@ -536,12 +1102,28 @@ static LUA_PROTO(w_echochar)
 /*
 * bool window:erase()
 */
-static LUA_PROTO(w_erase)
+LC_WFN(erase)
 {
-	lua_pushboolean(L, werase(lc_checkwindow(L, 1)) != ERR);
+	lua_pushboolean(L, werase(wh->win) != ERR);
 	return 1;
 }
 
+/*
+* int cells, int rows, int bytes = window:framestats()
+* Returns how many cells and rows changed at the last refresh of a window
+* with retain() enabled, and an estimate of the bytes curses will send for
+* them (text, plus a cursor move per row and an escape per attribute
+* change; curses' own optimizations aren't taken into account).
+*/
+static LUA_PROTO(w_framestats)
+{
+	winhandle *wh = lc_checkhandle(L, 1);
+	lua_pushinteger(L, wh->statcells);
+	lua_pushinteger(L, wh->statrows);
+	lua_pushinteger(L, wh->statbytes);
+	return 3;
+}
+
 /*
 * int window:getattrs()
 * Returns the window's current attributes in a single int.
@@ -576,43 +1158,217 @@ static LUA_PROTO(w_getbkgd)
 	return 1;
 }
 
+int lc_getdelay(lua_State *L, WINDOW *w)
+{
+#ifdef NCURSES_VERSION
+	(void)L;
+	return wgetdelay(w);
+#else
+	/* no way to ask, so use what timeout()/nodelay() last set */
+	winhandle *wh = lc_findwindow(L, w);
+	return wh ? wh->delay : -1;
+#endif
+}
+
+int lc_getkeypad(WINDOW *w)
+{
+#ifdef NCURSES_VERSION
+	return is_keypad(w);
+#else
+	(void)w;
+	return TRUE;
+#endif
+}
+
+WINDOW* lc_inputpad(int kp)
+{
+	static WINDOW *pad = NULL;
+	static int padkp = FALSE;
+
+	if (!pad) {
+		if (!(pad = newpad(1, 1)))
+			return NULL;
+		padkp = FALSE;
+	}
+	/* keypad() writes smkx/rmkx to the terminal, so only call it on a change */
+	if (kp != padkp) {
+		keypad(pad, kp);
+		padkp = kp;
+	}
+	wtimeout(pad, 0);
+	return pad;
+}
+
+int lc_pastekey = 0;
+
+/* how long to wait for more of a paste before giving up on its end marker */
+#define LC_PASTE_TIMEOUT 1000
+
+void lc_pushpaste(lua_State *L, WINDOW *w)
+{
+	size_t len = 0, cap = 256, endlen = sizeof(LC_PASTE_END) - 1;
+	char *buf = lc_scratch(L, cap);
+	int ch, delay, kp;
+
+	delay = lc_getdelay(L, w);
+	kp = lc_getkeypad(w);
+	/* read the paste raw, so nothing in it is taken for a function key */
+	keypad(w, FALSE);
+	wtimeout(w, LC_PASTE_TIMEOUT);
+	while ((ch = wgetch(w)) != ERR) {
+		if (len == cap)
+			buf = lc_scratch(L, cap *= 2);
+		buf[len++] = (char)ch;
+		if (ch == '~' && len >= endlen &&
+		    !memcmp(buf + len - endlen, LC_PASTE_END, endlen)) {
+			len -= endlen;
+			break;
+		}
+	}
+	keypad(w, kp);
+	wtimeout(w, delay);
+
+	lua_pushlstring(L, buf, len);
+}
+
 /*
-* int window:getch([int x, int y])
+* int[, str] window:getch([int x, int y])
+* With curses.bracketed_paste() on, a paste is returned all at once as
+* KEY_PASTE followed by the pasted text.
 */
-static LUA_PROTO(w_getch)
+LC_WFN(getch)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	if (lc_checkmv(L, w, 1))
-		lua_pushinteger(L, wgetch(w));
+	WINDOW *w = wh->win;
+	if (lc_checkmv(L, w, a, 1)) {
+		int ch = wgetch(w);
+		lua_pushinteger(L, ch);
+		if (LC_ISPASTE(ch)) {
+			lc_pushpaste(L, w);
+			return 2;
+		}
+	}
 	return 1;
 }
 
+int lc_countrepeats(lua_State *L, WINDOW *w, int ch)
+{
+	int n = 1, next, delay;
+
+	if (ch == ERR || LC_ISPASTE(ch) || ch == KEY_MOUSE)
+		return 1;
+
+	delay = lc_getdelay(L, w);
+	wtimeout(w, 0);
+	while ((next = wgetch(w)) == ch)
+		n++;
+	if (next != ERR)
+		ungetch(next);
+	wtimeout(w, delay);
+	return n;
+}
+
 /*
-* y, x = window:getmaxyx()
-* Returns the window's max coordinates, i.e. its size.
+* int, int[, str] window:getch_count([int x, int y])
+* Like getch(), but also takes any copies of the key already waiting behind
+* it and returns how many there were in all, so a held-down key gives one
+* event per read instead of a backlog. Pastes and mouse events are never
+* merged; a paste's text comes third.
 */
-static LUA_PROTO(w_getmaxyx)
+LC_WFN(getch_count)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int y, x;
-	getmaxyx(w, y, x);
-	lua_pushinteger(L, y);
-	lua_pushinteger(L, x);
+	WINDOW *w = wh->win;
+	int ch;
+
+	if (!lc_checkmv(L, w, a, 1))
+		return 1;
+
+	ch = wgetch(w);
+	lua_pushinteger(L, ch);
+	lua_pushinteger(L, ch == ERR ? 0 : lc_countrepeats(L, w, ch));
+	if (LC_ISPASTE(ch)) {
+		lc_pushpaste(L, w);
+		return 3;
+	}
 	return 2;
 }
 
 /*
-* y, x = window:getparyx()
-* Returns a subwindow's position relative to its parent.
-* If not a subwindow, returns nil.
+* table, int window:getch_all([table t], [int max])
+* Reads every key that's already available, without blocking, and returns
+* them as an array along with the count. If `t' is given it's filled in
+* (and any old entries past the end are cleared) instead of making a new
+* table, so it can be reused between frames. Stops after `max' keys, if
+* given. A bracketed paste is stored as a single string entry holding the
+* pasted text. The window's delay mode is left as it was.
 */
-static LUA_PROTO(w_getparyx)
+LC_WFN(getch_all)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int y, x;
-	getparyx(w, y, x);
-	if (y > 0) {
-		lua_pushinteger(L, y);
+	WINDOW *w = wh->win;
+	int max, n = 0, ch, delay, i;
+
+	if (lua_istable(L, a)) {
+		max = luaL_optint(L, a + 1, 0);
+		lua_settop(L, a);
+	} else {
+		max = luaL_optint(L, a, 0);
+		lua_settop(L, a - 1);
+		lua_newtable(L);
+	}
+
+	delay = lc_getdelay(L, w);
+	wtimeout(w, 0);
+	while ((max <= 0 || n < max) && (ch = wgetch(w)) != ERR) {
+		if (LC_ISPASTE(ch)) {
+			lc_pushpaste(L, w);
+			wtimeout(w, 0);
+		} else {
+			lua_pushinteger(L, ch);
+		}
+		lua_rawseti(L, a, ++n);
+	}
+	wtimeout(w, delay);
+
+	/* truncate a reused table */
+	for (i = n + 1; ; i++) {
+		lua_rawgeti(L, a, i);
+		if (lua_isnil(L, -1))
+			break;
+		lua_pop(L, 1);
+		lua_pushnil(L);
+		lua_rawseti(L, a, i);
+	}
+	lua_pop(L, 1);
+
+	lua_pushinteger(L, n);
+	return 2;
+}
+
+/*
+* y, x = window:getmaxyx()
+* Returns the window's max coordinates, i.e. its size.
+*/
+static LUA_PROTO(w_getmaxyx)
+{
+	WINDOW *w = lc_checkwindow(L, 1);
+	int y, x;
+	getmaxyx(w, y, x);
+	lua_pushinteger(L, y);
+	lua_pushinteger(L, x);
+	return 2;
+}
+
+/*
+* y, x = window:getparyx()
+* Returns a subwindow's position relative to its parent.
+* If not a subwindow, returns nil.
+*/
+static LUA_PROTO(w_getparyx)
+{
+	WINDOW *w = lc_checkwindow(L, 1);
+	int y, x;
+	getparyx(w, y, x);
+	if (y > 0) {
+		lua_pushinteger(L, y);
 		lua_pushinteger(L, x);
 		return 2;
 	} else {
@@ -624,27 +1380,27 @@ static LUA_PROTO(w_getparyx)
 /*
 * str window:getstr([int x, int y,] [int n])
 */
-static LUA_PROTO(w_getstr)
+LC_WFN(getstr)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	char *buf;
 	int n;
-	if (!lc_checkmv(L, w, 1))
+	if (!lc_checkmv(L, w, a, 1))
 		return 1;
-	n = luaL_optint(L, 2, -1);
+	n = luaL_optint(L, a, -1);
 	if (n < 0) {
 		n = LUAL_BUFFERSIZE;
 	} else if (n == 0) {
 		lua_pushstring(L, "");
 		return 1;
 	}
-	buf = malloc(n + 1);
+	buf = lc_scratch(L, n + 1);
+	buf[0] = '\0';
 	if (wgetnstr(w, buf, n) != ERR) {
-		lua_pushlstring(L, buf, n);
+		lua_pushstring(L, buf);
 	} else {
 		lua_pushnil(L);
 	}
-	free(buf);
 	return 1;
 }
 
@@ -665,15 +1421,15 @@ static LUA_PROTO(w_getyx)
 /*
 * bool window:hline([int y, int x], [int/str ch], [int n])
 */
-static LUA_PROTO(w_hline)
+LC_WFN(hline)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	chtype ch;
 	int n;
-	if (lc_checkmv(L, w, 0))
+	if (lc_checkmv(L, w, a, 0))
 		return 1;
-	ch = luaL_optint(L, 2, -1);
-	n = luaL_optint(L, 3, COLS);
+	ch = luaL_optint(L, a, -1);
+	n = luaL_optint(L, a + 1, COLS);
 	lua_pushboolean(L, whline(w, ch, n) != ERR);
 	return 1;
 }
@@ -720,10 +1476,10 @@ static LUA_PROTO(w_immedok)
 /*
 * int window:inch([int y, int x])
 */
-static LUA_PROTO(w_inch)
+LC_WFN(inch)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	if (lc_checkmv(L, w, 1))
+	WINDOW *w = wh->win;
+	if (lc_checkmv(L, w, a, 1))
 		lua_pushinteger(L, winch(w));
 	return 1;
 }
@@ -736,18 +1492,18 @@ LUA_UNIMP(w_inchstr)
 /*
 * bool window:insch([int y, int x,] int/str ch)
 */
-static LUA_PROTO(w_insch)
+LC_WFN(insch)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	chtype ch;
 
-	if (!lc_checkmv(L, w, 0))
+	if (!lc_checkmv(L, w, a, 0))
 		return 1;
 
-	if (lua_isnumber(L, 2))
-		ch = lua_tointeger(L, 2);
+	if (lua_isnumber(L, a))
+		ch = lua_tointeger(L, a);
 	else
-		ch = *luaL_checkstring(L, 2);
+		ch = *luaL_checkstring(L, a);
 	lua_pushboolean(L, winsch(w, ch) != ERR);
 	return 1;
 }
@@ -755,10 +1511,10 @@ static LUA_PROTO(w_insch)
 /*
 * bool window:insdelln(int n)
 */
-static LUA_PROTO(w_insdelln)
+LC_WFN(insdelln)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int n = luaL_checkint(L, 2);
+	WINDOW *w = wh->win;
+	int n = luaL_checkint(L, a);
 	lua_pushboolean(L, winsdelln(w, n) != ERR);
 	return 1;
 }
@@ -766,24 +1522,24 @@ static LUA_PROTO(w_insdelln)
 /*
 * bool widnow:insertln()
 */
-static LUA_PROTO(w_insertln)
+LC_WFN(insertln)
 {
-	lua_pushboolean(L, winsertln(lc_checkwindow(L, 1)) != ERR);
+	lua_pushboolean(L, winsertln(wh->win) != ERR);
 	return 1;
 }
 
 /*
 * bool window:insstr([int y, int x,] str s, [int n])
 */
-static LUA_PROTO(w_insstr)
+LC_WFN(insstr)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	const char *str;
 	int n;
-	if (!lc_checkmv(L, w, 0))
+	if (!lc_checkmv(L, w, a, 0))
 		return 1;
-	str = luaL_checkstring(L, 2);
-	n = luaL_optint(L, 3, -1);
+	str = luaL_checkstring(L, a);
+	n = luaL_optint(L, a + 1, -1);
 	lua_pushboolean(L, winsnstr(w, str, n) != ERR);
 	return 1;
 }
@@ -791,27 +1547,27 @@ static LUA_PROTO(w_insstr)
 /*
 * str window:instr([int y, int x,] [int n])
 */
-static LUA_PROTO(w_instr)
+LC_WFN(instr)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	char *buf;
 	int n;
-	if (!lc_checkmv(L, w, 1))
+	if (!lc_checkmv(L, w, a, 1))
 		return 1;
-	n = luaL_optint(L, 2, -1);
+	n = luaL_optint(L, a, -1);
 	if (n < 0) {
 		n = LUAL_BUFFERSIZE;
 	} else if (n == 0) {
 		lua_pushstring(L, "");
 		return 1;
 	}
-	buf = malloc(n + 1);
+	buf = lc_scratch(L, n + 1);
+	buf[0] = '\0';
 	if (winnstr(w, buf, n) != ERR) {
-		lua_pushlstring(L, buf, n);
+		lua_pushstring(L, buf);
 	} else {
 		lua_pushnil(L);
 	}
-	free(buf);
 	return 1;
 }
 
@@ -871,10 +1627,10 @@ static LUA_PROTO(w_is_wintouched)
 * a single value representing function keys when pressed, e.g. KEY_LEFT.
 * Off by default.
 */
-static LUA_PROTO(w_keypad)
+LC_WFN(keypad)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int enable = luaL_checkbool(L, 2);
+	WINDOW *w = wh->win;
+	int enable = luaL_checkbool(L, a);
 	lua_pushboolean(L, keypad(w, enable) != ERR);
 	return 1;
 }
@@ -911,11 +1667,11 @@ static LUA_PROTO(w_meta)
 /*
 * bool window:move(y, x)
 */
-static LUA_PROTO(w_move)
+LC_WFN(move)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int y = luaL_checkint(L, 2);
-	int x = luaL_checkint(L, 3);
+	WINDOW *w = wh->win;
+	int y = luaL_checkint(L, a);
+	int x = luaL_checkint(L, a + 1);
 	lua_pushboolean(L, wmove(w, y, x) != ERR);
 	return 1;
 }
@@ -945,9 +1701,11 @@ static LUA_PROTO(w_mvwin)
 */
 static LUA_PROTO(w_nodelay)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int enable = luaL_checkbool(L, 2);
-	lua_pushboolean(L, nodelay(w, enable) != ERR);
+	winhandle *wh = lc_checkhandle(L, 1);
+	int enable = luaL_checkbool(L, 2), ok;
+	if ((ok = nodelay(wh->win, enable) != ERR))
+		wh->delay = enable ? 0 : -1;
+	lua_pushboolean(L, ok);
 	return 1;
 }
 
@@ -967,7 +1725,10 @@ static LUA_PROTO(w_notimeout)
 */
 static LUA_PROTO(w_noutrefresh)
 {
-	lua_pushboolean(L, wnoutrefresh(lc_checkwindow(L, 1)) != ERR);
+	winhandle *wh = lc_checkhandle(L, 1);
+	if (wh->shadow)
+		lc_diffshadow(wh);
+	lua_pushboolean(L, wnoutrefresh(wh->win) != ERR);
 	return 1;
 }
 
@@ -997,6 +1758,241 @@ static LUA_PROTO(w_overwrite)
 	return 1;
 }
 
+#if LUA_VERSION_NUM >= 503
+/*
+* the formatting below follows str_format() from Lua 5.3/5.4's lstrlib.c,
+* so printw() accepts what string.format() does: integers are read as
+* lua_Integer (floats without an integer value are an error), %s goes
+* through __tostring, and %q takes any value with a literal form.
+*/
+#define LC_FMTFLAGS "-+ #0"
+#define LC_FMTITEM  512 /* max size of a single formatted item */
+#define LC_FMTSIZE  (sizeof(LC_FMTFLAGS) + 2 + 10) /* '%', flags, width, precision */
+
+static const char* lc_scanformat(lua_State *L, const char *strfrmt, char *form)
+{
+	const char *p = strfrmt;
+	while (*p != '\0' && strchr(LC_FMTFLAGS, *p) != NULL)
+		p++;
+	if ((size_t)(p - strfrmt) >= sizeof(LC_FMTFLAGS))
+		luaL_error(L, "invalid format (repeated flags)");
+	if (isdigit((unsigned char)*p)) p++; /* skip width */
+	if (isdigit((unsigned char)*p)) p++; /* (2 digits at most) */
+	if (*p == '.') {
+		p++;
+		if (isdigit((unsigned char)*p)) p++; /* skip precision */
+		if (isdigit((unsigned char)*p)) p++; /* (2 digits at most) */
+	}
+	if (isdigit((unsigned char)*p))
+		luaL_error(L, "invalid format (width or precision too long)");
+	*(form++) = '%';
+	strncpy(form, strfrmt, p - strfrmt + 1);
+	form += p - strfrmt + 1;
+	*form = '\0';
+	return p;
+}
+
+/* inserts a length modifier before the conversion at the end of form */
+static void lc_addlenmod(char *form, const char *lenmod)
+{
+	size_t l = strlen(form);
+	size_t lm = strlen(lenmod);
+	char spec = form[l - 1];
+	strcpy(form + l - 1, lenmod);
+	form[l + lm - 1] = spec;
+	form[l + lm] = '\0';
+}
+
+static void lc_fmtquoted(lua_State *L, luaL_Buffer *b, int arg)
+{
+	size_t l;
+	const char *s = lua_tolstring(L, arg, &l);
+	luaL_addchar(b, '"');
+	while (l--) {
+		switch (*s) {
+		case '"': case '\\': case '\n':
+			luaL_addchar(b, '\\');
+			luaL_addchar(b, *s);
+			break;
+		case '\r':
+			luaL_addlstring(b, "\\r", 2);
+			break;
+		case '\0':
+			luaL_addlstring(b, "\\000", 4);
+			break;
+		default:
+			luaL_addchar(b, *s);
+			break;
+		}
+		s++;
+	}
+	luaL_addchar(b, '"');
+}
+
+/* %q: writes the value at arg so that Lua would read it back the same */
+static void lc_fmtliteral(lua_State *L, luaL_Buffer *b, int arg)
+{
+	char item[LC_FMTITEM];
+
+	switch (lua_type(L, arg)) {
+	case LUA_TSTRING:
+		lc_fmtquoted(L, b, arg);
+		return;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, arg)) {
+			lua_Integer n = lua_tointeger(L, arg);
+			/* LUA_MININTEGER has no decimal literal; write it in hex */
+			sprintf(item, n == LUA_MININTEGER ?
+				"0x%" LUA_INTEGER_FRMLEN "x" : LUA_INTEGER_FMT, (LUAI_UACINT)n);
+		} else {
+			lua_Number n = lua_tonumber(L, arg);
+			if (n == (lua_Number)HUGE_VAL)
+				strcpy(item, "1e9999");
+			else if (n == -(lua_Number)HUGE_VAL)
+				strcpy(item, "-1e9999");
+			else if (n != n)
+				strcpy(item, "(0/0)");
+			else { /* hex floats keep every bit */
+				char form[sizeof(LUA_NUMBER_FRMLEN) + 2] = "%a";
+				lc_addlenmod(form, LUA_NUMBER_FRMLEN);
+				sprintf(item, form, (LUAI_UACNUMBER)n);
+			}
+		}
+		luaL_addstring(b, item);
+		return;
+	case LUA_TNIL: case LUA_TBOOLEAN:
+		luaL_tolstring(L, arg, NULL);
+		luaL_addvalue(b);
+		return;
+	default:
+		luaL_argerror(L, arg, "value has no literal form");
+	}
+}
+
+/*
+* bool window:printw([int y, int x,] str fmt, ...)
+* Formats the arguments like string.format() and adds the result to the
+* window. The text is built in a luaL_Buffer and never made into a Lua
+* string, so short output doesn't allocate.
+*/
+LC_WFN(printw)
+{
+	WINDOW *w = wh->win;
+	int top, arg = a;
+	size_t sfl;
+	const char *strfrmt, *strfrmt_end;
+	luaL_Buffer b;
+
+	if (!lc_checkmv(L, w, a, 0))
+		return 1;
+	top = lua_gettop(L);
+	strfrmt = luaL_checklstring(L, arg, &sfl);
+	strfrmt_end = strfrmt + sfl;
+	luaL_buffinit(L, &b);
+
+	while (strfrmt < strfrmt_end) {
+		/* + room for the longest length modifier */
+		char form[LC_FMTSIZE + sizeof(LUA_INTEGER_FRMLEN) + sizeof(LUA_NUMBER_FRMLEN)];
+		char item[LC_FMTITEM];
+		const char *start = strfrmt;
+		int nb;
+
+		/* copy plain text up to the next '%' in one go */
+		while (strfrmt < strfrmt_end && *strfrmt != '%')
+			strfrmt++;
+		if (strfrmt > start)
+			luaL_addlstring(&b, start, strfrmt - start);
+		if (strfrmt >= strfrmt_end)
+			break;
+
+		if (*++strfrmt == '%') {
+			luaL_addchar(&b, *strfrmt++);
+			continue;
+		}
+
+		if (++arg > top)
+			luaL_argerror(L, arg, "no value");
+		strfrmt = lc_scanformat(L, strfrmt, form);
+		switch (*strfrmt++) {
+		case 'c':
+			/* use the count, %c of 0 writes a NUL */
+			nb = sprintf(item, form, (int)luaL_checkinteger(L, arg));
+			break;
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': {
+			lua_Integer n = luaL_checkinteger(L, arg);
+			lc_addlenmod(form, LUA_INTEGER_FRMLEN);
+			nb = sprintf(item, form, (LUAI_UACINT)n);
+			break;
+		}
+		case 'a': case 'A':
+		case 'e': case 'E': case 'f': case 'g': case 'G':
+			lc_addlenmod(form, LUA_NUMBER_FRMLEN);
+			nb = sprintf(item, form, (LUAI_UACNUMBER)luaL_checknumber(L, arg));
+			break;
+		case 'q':
+			if (form[2] != '\0')
+				return luaL_error(L, "specifier '%%q' cannot have modifiers");
+			lc_fmtliteral(L, &b, arg);
+			continue;
+		case 's': {
+			size_t l;
+			const char *s = luaL_tolstring(L, arg, &l);
+			if (form[2] == '\0') {
+				/* no modifiers: keep the entire string */
+				luaL_addvalue(&b);
+				continue;
+			}
+			luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+			if (!strchr(form, '.') && l >= 100) {
+				/* no precision and too long to be formatted: keep it whole */
+				luaL_addvalue(&b);
+				continue;
+			}
+			nb = sprintf(item, form, s);
+			lua_pop(L, 1);
+			break;
+		}
+		default:
+			return luaL_error(L, "invalid conversion '%s' to 'printw'", form);
+		}
+		luaL_addlstring(&b, item, nb);
+	}
+
+	/* the buffer is dropped with the stack, no string needed */
+	lua_pushboolean(L, waddnstr(w, b.b, (int)b.n) != ERR);
+	return 1;
+}
+#else
+/*
+* bool window:printw([int y, int x,] str fmt, ...)
+* Formats the arguments with string.format() and adds the result to the
+* window. 5.1 and 5.2 differ too much in how they format numbers to copy,
+* so this calls the real one.
+*/
+LC_WFN(printw)
+{
+	WINDOW *w = wh->win;
+	const char *s;
+	size_t len;
+
+	if (!lc_checkmv(L, w, a, 0))
+		return 1;
+	luaL_checkstring(L, a);
+
+	lua_getglobal(L, "string");
+	if (!lua_istable(L, -1))
+		return luaL_error(L, "printw needs the string library");
+	lua_getfield(L, -1, "format");
+	lua_remove(L, -2);
+	lua_insert(L, a);
+	lua_call(L, lua_gettop(L) - a, 1);
+
+	s = lua_tolstring(L, -1, &len);
+	lua_pushboolean(L, waddnstr(w, s, len) != ERR);
+	return 1;
+}
+#endif
+
 /*
 * bool window:putwin(file f)
 * Writes all data associated with the window to a file, which can be
@@ -1004,15 +2000,76 @@ static LUA_PROTO(w_overwrite)
 */
 LUA_UNIMP(w_putwin) /* TODO */
 
+/*
+* chstr window:read_region(int y, int x, int h, int w, [chstr dest])
+* Captures an h by w rectangle of the window's cells, row by row, into a
+* chstr of h*w cells. Cells outside the window are blanks. If `dest' is
+* given (and has room) it is filled and returned instead of a new chstr.
+* The cursor is left where it was.
+*/
+static LUA_PROTO(w_read_region)
+{
+	WINDOW *w = lc_checkwindow(L, 1);
+	int y = luaL_checkint(L, 2);
+	int x = luaL_checkint(L, 3);
+	int h = luaL_checkint(L, 4);
+	int wid = luaL_checkint(L, 5);
+	int maxy, maxx, cy, cx, row, n;
+	chtype *cells, *buf;
+	chstr *cs;
+
+	luaL_argcheck(L, h >= 0, 4, "invalid height");
+	luaL_argcheck(L, wid >= 0, 5, "invalid width");
+
+	if (lua_isnoneornil(L, 6)) {
+		cs = lc_pushchstr(L, h * wid);
+	} else {
+		cs = lc_checkchstr(L, 6);
+		luaL_argcheck(L, cs->len >= (size_t)(h * wid), 6, "chstr too short");
+		lua_pushvalue(L, 6);
+	}
+	cells = LC_CHSTR_STR(cs);
+
+	for (n = 0; n < h * wid; n++)
+		cells[n] = ' ';
+
+	getmaxyx(w, maxy, maxx);
+	getyx(w, cy, cx);
+
+	/* clip to the window; winchnstr also writes a terminator, so go via buf */
+	n = wid;
+	if (x < 0) {
+		cells -= x;
+		n += x;
+		x = 0;
+	}
+	if (x + n > maxx)
+		n = maxx - x;
+	buf = (chtype*)lc_scratch(L, (wid + 1) * sizeof(chtype));
+
+	for (row = y < 0 ? 0 : y; n > 0 && row < y + h && row < maxy; row++) {
+		int got = 0;
+		/* some curses return OK rather than a count, so find the terminator */
+		if (mvwinchnstr(w, row, x, buf, n) != ERR)
+			while (got < n && buf[got])
+				got++;
+		memcpy(cells + (row - y) * wid, buf, got * sizeof(chtype));
+	}
+
+	wmove(w, cy, cx);
+	return 1;
+}
+
 /*
 * bool window:redrawln(int beg_line, int num_lines)
 */
 static LUA_PROTO(w_redrawln)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	winhandle *wh = lc_checkhandle(L, 1);
 	int start = luaL_checkint(L, 2);
 	int lines = luaL_checkint(L, 3);
-	lua_pushboolean(L, wredrawln(w, start, lines) != ERR);
+	lc_forgetrows(wh, start, lines);
+	lua_pushboolean(L, wredrawln(wh->win, start, lines) != ERR);
 	return 1;
 }
 
@@ -1022,27 +2079,54 @@ static LUA_PROTO(w_redrawln)
 */
 static LUA_PROTO(w_redrawwin)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	lua_pushboolean(L, redrawwin(w) != ERR);
+	winhandle *wh = lc_checkhandle(L, 1);
+	lc_forgetrows(wh, 0, wh->shadowh);
+	lua_pushboolean(L, redrawwin(wh->win) != ERR);
 	return 1;
 }
 
 /*
 * bool window:refresh()
 */
-static LUA_PROTO(w_refresh)
+LC_WFN(refresh)
 {
-	lua_pushboolean(L, wrefresh(lc_checkwindow(L, 1)) != ERR);
+	if (wh->shadow)
+		lc_diffshadow(wh);
+	lua_pushboolean(L, wrefresh(wh->win) != ERR);
+	return 1;
+}
+
+/*
+* bool window:retain(bool enable)
+* Keeps a copy of the window's cells as of the last refresh. When enabled,
+* refresh() and noutrefresh() skip rows whose contents haven't changed
+* since then, even if they were redrawn. Rows marked with touchwin(),
+* touchline(), touchln(), redrawwin() or redrawln() are always sent, so
+* a part that another window covered can still be repainted. Enabling it
+* again forgets the whole copy.
+* Returns false if the copy couldn't be allocated.
+*/
+static LUA_PROTO(w_retain)
+{
+	winhandle *wh = lc_checkhandle(L, 1);
+	int enable = luaL_checkbool(L, 2);
+	if (enable) {
+		lua_pushboolean(L, lc_resetshadow(wh));
+	} else {
+		free(wh->shadow);
+		wh->shadow = NULL;
+		lua_pushboolean(L, 1);
+	}
 	return 1;
 }
 
 /*
 * bool window:scrl(int n)
 */
-static LUA_PROTO(w_scrl)
+LC_WFN(scrl)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int n = luaL_checkint(L, 2);
+	WINDOW *w = wh->win;
+	int n = luaL_checkint(L, a);
 	lua_pushboolean(L, wscrl(w, n) != ERR);
 	return 1;
 }
@@ -1075,11 +2159,11 @@ static LUA_PROTO(w_scrollok)
 /*
 * bool window:setscrreg(int top, int bot)
 */
-static LUA_PROTO(w_setscrreg)
+LC_WFN(setscrreg)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int top = luaL_checkint(L, 2);
-	int bot = luaL_checkint(L, 3);
+	WINDOW *w = wh->win;
+	int top = luaL_checkint(L, a);
+	int bot = luaL_checkint(L, a + 1);
 	lua_pushboolean(L, wsetscrreg(w, top, bot) != ERR);
 	return 1;
 }
@@ -1087,18 +2171,18 @@ static LUA_PROTO(w_setscrreg)
 /*
 * bool window:standend()
 */
-static LUA_PROTO(w_standend)
+LC_WFN(standend)
 {
-	lua_pushboolean(L, wstandend(lc_checkwindow(L, 1)) != ERR);
+	lua_pushboolean(L, wstandend(wh->win) != ERR);
 	return 1;
 }
 
 /*
 * bool window:standout()
 */
-static LUA_PROTO(w_standout)
+LC_WFN(standout)
 {
-	lua_pushboolean(L, wstandout(lc_checkwindow(L, 1)) != ERR);
+	lua_pushboolean(L, wstandout(wh->win) != ERR);
 	return 1;
 }
 
@@ -1117,8 +2201,8 @@ static LUA_PROTO(w_subpad)
 
 	WINDOW *sub = subpad(wh->win, nlines, ncols, beginy, beginx);
 	winhandle *subh = lc_pushwindow(L, sub);
-	subh->next = wh->sub;
-	wh->sub = subh;
+	if (subh)
+		lc_linkhandle(L, 1, subh);
 
 	return 1;
 }
@@ -1129,12 +2213,14 @@ static LUA_PROTO(w_subpad)
 */
 static LUA_PROTO(w_subwin)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	winhandle *wh = lc_checkhandle(L, 1);
 	int nlines = luaL_checkint(L, 2);
 	int ncols = luaL_checkint(L, 3);
 	int beginy = luaL_checkint(L, 4);
 	int beginx = luaL_checkint(L, 5);
-	lc_pushwindow(L, subwin(w, nlines, ncols, beginy, beginx));
+	winhandle *subh = lc_pushwindow(L, subwin(wh->win, nlines, ncols, beginy, beginx));
+	if (subh)
+		lc_linkhandle(L, 1, subh);
 	return 1;
 }
 
@@ -1172,11 +2258,11 @@ static LUA_PROTO(w_syncup)
 /*
 * void window:timeout(int delay)
 */
-static LUA_PROTO(w_timeout)
+LC_WFN(timeout)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	int delay = luaL_checkint(L, 2);
-	wtimeout(w, delay);
+	int delay = luaL_checkint(L, a);
+	wtimeout(wh->win, delay);
+	wh->delay = delay < 0 ? -1 : delay;
 	return 0;
 }
 
@@ -1186,10 +2272,11 @@ static LUA_PROTO(w_timeout)
 */
 static LUA_PROTO(w_touchline)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	winhandle *wh = lc_checkhandle(L, 1);
 	int start = luaL_checkint(L, 2);
 	int count = luaL_checkint(L, 3);
-	lua_pushboolean(L, touchline(w, start, count) != ERR);
+	lc_forgetrows(wh, start, count);
+	lua_pushboolean(L, touchline(wh->win, start, count) != ERR);
 	return 1;
 }
 
@@ -1198,11 +2285,13 @@ static LUA_PROTO(w_touchline)
 */
 static LUA_PROTO(w_touchln)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	winhandle *wh = lc_checkhandle(L, 1);
 	int start = luaL_checkint(L, 2);
 	int nlines = luaL_checkint(L, 3);
 	int changed = luaL_checkbool(L, 4);
-	lua_pushboolean(L, wtouchln(w, start, nlines, changed) != ERR);
+	if (changed)
+		lc_forgetrows(wh, start, nlines);
+	lua_pushboolean(L, wtouchln(wh->win, start, nlines, changed) != ERR);
 	return 1;
 }
 
@@ -1212,8 +2301,9 @@ static LUA_PROTO(w_touchln)
 */
 static LUA_PROTO(w_touchwin)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
-	lua_pushboolean(L, touchwin(w) != ERR);
+	winhandle *wh = lc_checkhandle(L, 1);
+	lc_forgetrows(wh, 0, wh->shadowh);
+	lua_pushboolean(L, touchwin(wh->win) != ERR);
 	return 1;
 }
 
@@ -1231,43 +2321,315 @@ static LUA_PROTO(w_untouchwin)
 /*
 * bool window:vline([int y, int x], [int/str ch], [int n])
 */
-static LUA_PROTO(w_vline)
+LC_WFN(vline)
 {
-	WINDOW *w = lc_checkwindow(L, 1);
+	WINDOW *w = wh->win;
 	chtype ch;
 	int n;
-	if (lc_checkmv(L, w, 0))
+	if (lc_checkmv(L, w, a, 0))
 		return 1;
-	ch = luaL_optint(L, 2, -1);
-	n = luaL_optint(L, 3, LINES);
+	ch = luaL_optint(L, a, -1);
+	n = luaL_optint(L, a + 1, LINES);
 	lua_pushboolean(L, wvline(w, ch, n) != ERR);
 	return 1;
 }
 
 #ifdef LC_WIDE
-static LUA_PROTO(w_add_wch)
-static LUA_PROTO(w_add_wchnstr)
-static LUA_PROTO(w_add_wchstr)
-static LUA_PROTO(w_addnwstr)
-static LUA_PROTO(w_addwstr)
+/*
+* The wide functions take characters as code points or UTF-8 strings, and
+* return UTF-8 strings. See lc_wide.h about the locale.
+*/
+
+/*
+* bool window:add_wch([int y, int x,] int/str ch, [int attrs])
+*/
+LC_WFN(add_wch)
+{
+	WINDOW *w = wh->win;
+	cchar_t cc;
+	if (!lc_checkmv(L, w, a, 0))
+		return 1;
+	lc_checkcchar(L, a, a + 1, &cc);
+	lua_pushboolean(L, wadd_wch(w, &cc) != ERR);
+	return 1;
+}
+
+/*
+* bool window:add_wchstr([int y, int x,] ...)
+* TODO. Needs a cchar_t counterpart to chstr.
+*/
+LUA_UNIMP(w_add_wchstr)
+
+/*
+* bool window:addwstr([int y, int x,] str, [int n])
+* Adds a UTF-8 string to the window, wrapping at EOL.
+* If n is specified, only writes n characters.
+*/
+LC_WFN(addwstr)
+{
+	WINDOW *w = wh->win;
+	const char *s;
+	size_t len;
+	int n, rv;
+	if (!lc_checkmv(L, w, a, 0))
+		return 1;
+	s = luaL_checklstring(L, a, &len);
+	n = luaL_optint(L, a + 1, -1);
+	/*
+	* always go through wchar_t: ncursesw's waddnstr() runs every byte
+	* through its own multibyte decoder, which is slower than ours
+	*/
+	rv = waddnwstr(w, lc_towstr(L, s, len, &len), n);
+	lua_pushboolean(L, rv != ERR);
+	return 1;
+}
+
+/*
+* bool window:bkgrnd(int/str ch, [int attrs])
+*/
 static LUA_PROTO(w_bkgrnd)
+{
+	WINDOW *w = lc_checkwindow(L, 1);
+	cchar_t cc;
+	lc_checkcchar(L, 2, 3, &cc);
+	lua_pushboolean(L, wbkgrnd(w, &cc) != ERR);
+	return 1;
+}
+
+/*
+* void window:bkgrndset(int/str ch, [int attrs])
+*/
 static LUA_PROTO(w_bkgrndset)
-static LUA_PROTO(w_border_set)
+{
+	WINDOW *w = lc_checkwindow(L, 1);
+	cchar_t cc;
+	lc_checkcchar(L, 2, 3, &cc);
+	wbkgrndset(w, &cc);
+	return 0;
+}
+
+/*
+* bool window:border_set([ls], [rs], [ts], [bs], [tl], [tr], [bl], [br])
+* Like border(), with each side or corner given as an int/str char.
+* Missing ones use the default line-drawing characters.
+*/
+LC_WFN(border_set)
+{
+	WINDOW *w = wh->win;
+	cchar_t cc[8];
+	cchar_t *p[8];
+	int i;
+	for (i = 0; i < 8; i++) {
+		if (lua_isnoneornil(L, a + i)) {
+			p[i] = NULL;
+		} else {
+			lc_checkcchar(L, a + i, 0, &cc[i]);
+			p[i] = &cc[i];
+		}
+	}
+	lua_pushboolean(L,
+		wborder_set(w, p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]) != ERR);
+	return 1;
+}
+
+/*
+* bool window:echo_wchar(int/str ch, [int attrs])
+*/
 static LUA_PROTO(w_echo_wchar)
-static LUA_PROTO(w_get_wch)
-static LUA_PROTO(w_get_wstr)
+{
+	WINDOW *w = lc_checkwindow(L, 1);
+	cchar_t cc;
+	lc_checkcchar(L, 2, 3, &cc);
+	lua_pushboolean(L, wecho_wchar(w, &cc) != ERR);
+	return 1;
+}
+
+/*
+* int/str window:get_wch([int y, int x])
+* Reads a key. Characters are returned as UTF-8 strings and function keys
+* as KEY_* codes, or nil if there's no input. A bracketed paste is returned
+* as KEY_PASTE followed by its text.
+*/
+LC_WFN(get_wch)
+{
+	WINDOW *w = wh->win;
+	wint_t wc;
+	int rv;
+	if (!lc_checkmv(L, w, a, 1))
+		return 1;
+	rv = wget_wch(w, &wc);
+	if (rv == KEY_CODE_YES) {
+		lua_pushinteger(L, wc);
+		if (LC_ISPASTE((int)wc)) {
+			lc_pushpaste(L, w);
+			return 2;
+		}
+	} else if (rv != ERR) {
+		wchar_t ch = (wchar_t)wc;
+		lc_pushwstr(L, &ch, 1);
+	} else {
+		lua_pushnil(L);
+	}
+	return 1;
+}
+
+/*
+* str window:get_wstr([int y, int x,] [int n])
+*/
+LC_WFN(get_wstr)
+{
+	WINDOW *w = wh->win;
+	wint_t *buf;
+	wchar_t *ws;
+	int n, i;
+	if (!lc_checkmv(L, w, a, 1))
+		return 1;
+	n = luaL_optint(L, a, -1);
+	if (n < 0) {
+		n = LUAL_BUFFERSIZE;
+	} else if (n == 0) {
+		lua_pushstring(L, "");
+		return 1;
+	}
+	buf = (wint_t*)lc_scratch(L, (n + 1) * (sizeof(wint_t) + sizeof(wchar_t)));
+	ws = (wchar_t*)(buf + n + 1);
+	buf[0] = 0;
+	if (wgetn_wstr(w, buf, n) == ERR) {
+		lua_pushnil(L);
+		return 1;
+	}
+	for (i = 0; i < n && buf[i]; i++)
+		ws[i] = (wchar_t)buf[i];
+	lc_pushwstr(L, ws, i);
+	return 1;
+}
+
+/*
+* str, int window:getbkgrnd()
+* Returns the window's background char and attributes.
+*/
 static LUA_PROTO(w_getbkgrnd)
-static LUA_PROTO(w_getn_wstr)
-static LUA_PROTO(w_hline_set)
-static LUA_PROTO(w_in_wch)
-static LUA_PROTO(w_in_wchnstr)
-static LUA_PROTO(w_in_wchstr)
-static LUA_PROTO(w_innwstr)
-static LUA_PROTO(w_ins_nwstr)
-static LUA_PROTO(w_ins_wch)
-static LUA_PROTO(w_ins_wstr)
-static LUA_PROTO(w_inwstr)
-static LUA_PROTO(w_vline_set)
+{
+	WINDOW *w = lc_checkwindow(L, 1);
+	cchar_t cc;
+	if (wgetbkgrnd(w, &cc) == ERR) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lc_pushcchar(L, &cc);
+	return 2;
+}
+
+/*
+* bool window:hline_set([int y, int x,] int/str ch, int n, [int attrs])
+*/
+LC_WFN(hline_set)
+{
+	WINDOW *w = wh->win;
+	cchar_t cc;
+	if (!lc_checkmv(L, w, a, 0))
+		return 1;
+	lc_checkcchar(L, a, a + 2, &cc);
+	lua_pushboolean(L, whline_set(w, &cc, luaL_checkint(L, a + 1)) != ERR);
+	return 1;
+}
+
+/*
+* str, int window:in_wch([int y, int x])
+* Returns the character at the cursor and its attributes.
+*/
+LC_WFN(in_wch)
+{
+	WINDOW *w = wh->win;
+	cchar_t cc;
+	if (!lc_checkmv(L, w, a, 1))
+		return 1;
+	if (win_wch(w, &cc) == ERR) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lc_pushcchar(L, &cc);
+	return 2;
+}
+
+/*
+* ... window:in_wchstr([int y, int x,] [int n])
+* TODO. Needs a cchar_t counterpart to chstr.
+*/
+LUA_UNIMP(w_in_wchstr)
+
+/*
+* bool window:ins_wch([int y, int x,] int/str ch, [int attrs])
+*/
+LC_WFN(ins_wch)
+{
+	WINDOW *w = wh->win;
+	cchar_t cc;
+	if (!lc_checkmv(L, w, a, 0))
+		return 1;
+	lc_checkcchar(L, a, a + 1, &cc);
+	lua_pushboolean(L, wins_wch(w, &cc) != ERR);
+	return 1;
+}
+
+/*
+* bool window:ins_wstr([int y, int x,] str s, [int n])
+*/
+LC_WFN(ins_wstr)
+{
+	WINDOW *w = wh->win;
+	const char *s;
+	size_t len;
+	int n, rv;
+	if (!lc_checkmv(L, w, a, 0))
+		return 1;
+	s = luaL_checklstring(L, a, &len);
+	n = luaL_optint(L, a + 1, -1);
+	rv = wins_nwstr(w, lc_towstr(L, s, len, &len), n);
+	lua_pushboolean(L, rv != ERR);
+	return 1;
+}
+
+/*
+* str window:inwstr([int y, int x,] [int n])
+*/
+LC_WFN(inwstr)
+{
+	WINDOW *w = wh->win;
+	wchar_t *buf;
+	int n;
+	if (!lc_checkmv(L, w, a, 1))
+		return 1;
+	n = luaL_optint(L, a, -1);
+	if (n < 0) {
+		n = LUAL_BUFFERSIZE;
+	} else if (n == 0) {
+		lua_pushstring(L, "");
+		return 1;
+	}
+	buf = (wchar_t*)lc_scratch(L, (n + 1) * sizeof(wchar_t));
+	buf[0] = 0;
+	if (winnwstr(w, buf, n) != ERR) {
+		lc_pushwstr(L, buf, n);
+	} else {
+		lua_pushnil(L);
+	}
+	return 1;
+}
+
+/*
+* bool window:vline_set([int y, int x,] int/str ch, int n, [int attrs])
+*/
+LC_WFN(vline_set)
+{
+	WINDOW *w = wh->win;
+	cchar_t cc;
+	if (!lc_checkmv(L, w, a, 0))
+		return 1;
+	lc_checkcchar(L, a, a + 2, &cc);
+	lua_pushboolean(L, wvline_set(w, &cc, luaL_checkint(L, a + 1)) != ERR);
+	return 1;
+}
 #endif
 
 #ifdef LC_NCURSES
@@ -1293,14 +2655,14 @@ static LUA_PROTO(w_resize)
 
 static LUA_PROTO(w_isvalid)
 {
-	winhandle *wh = *((winhandle**)luaL_checkudata(L, 1, LC_WINDOWMT));
+	winhandle *wh = lc_tohandle(L, 1);
 	lua_pushboolean(L, wh->win != NULL);
 	return 1;
 }
 
 static LUA_PROTO(w___tostring)
 {
-	winhandle *wh = *((winhandle**)luaL_checkudata(L, 1, LC_WINDOWMT));
+	winhandle *wh = lc_tohandle(L, 1);
 	if (wh->win == NULL) {
 		lua_pushstring(L, "INVALID WINDOW");
 	} else if (wh->win == stdscr) {
@@ -1311,37 +2673,17 @@ static LUA_PROTO(w___tostring)
 	return 1;
 }
 
-static LUA_PROTO(w___eq)
-{
-	winhandle *wh1 = *((winhandle**)luaL_checkudata(L, 1, LC_WINDOWMT));
-	winhandle *wh2 = *((winhandle**)luaL_checkudata(L, 2, LC_WINDOWMT));
-	lua_pushboolean(L, wh1->win == wh2->win);
-	return 1;
-}
-
 static LUA_PROTO(w___gc)
 {
-	winhandle *wh = *((winhandle**)luaL_checkudata(L, 1, LC_WINDOWMT));
+	winhandle *wh = lc_tohandle(L, 1);
 
 	wh->refs -= 1;
 
 	if (wh->refs <= 0) {
-		/* delete window and subwindows */
+		/* delete window and subwindows (also yanks them from the map) */
 		lc_closehandle(wh);
-
-		/* yank from window list */
-		if (wh == lc_winlist) {
-			lc_winlist = wh->hnext;
-		} else {
-			winhandle *cur = lc_winlist;
-			while (cur) {
-				if (cur->hnext == wh) {
-					cur->hnext = wh->hnext;
-					break;
-				}
-				cur = cur->hnext;
-			}
-		}
+		luaL_unref(L, LUA_REGISTRYINDEX, wh->parentref);
+		lc_freehandle(wh);
 	}
 	return 0;
 }
@@ -1350,12 +2692,15 @@ static LUA_PROTO(w___gc)
 
 static const luaL_Reg windowfuncs[] = {
 	LCF(__tostring),
-	LCF(__eq),
 	LCF(__gc),
+	{ "__close", w_close },
 	LCF(isvalid),
 	LCF(addch),
+	LCF(addch_at),
 	LCF(addchstr),
+	LCF(addchstr_at),
 	LCF(addstr),
+	LCF(addstr_at),
 	LCF(attr_get),
 	LCF(attr_off),
 	LCF(attr_on),
@@ -1363,6 +2708,7 @@ static const luaL_Reg windowfuncs[] = {
 	LCF(attroff),
 	LCF(attron),
 	LCF(attrset),
+	LCF(batch),
 	LCF(bkgd),
 	LCF(bkgdset),
 	LCF(border),
@@ -1372,6 +2718,8 @@ static const luaL_Reg windowfuncs[] = {
 	LCF(clearok),
 	LCF(clrtobot),
 	LCF(clrtoeol),
+	LCF(close),
+	LCF(close_tree),
 	LCF(color_set),
 	LCF(copywin),
 	LCF(cursyncup),
@@ -1382,10 +2730,13 @@ static const luaL_Reg windowfuncs[] = {
 	LCF(dupwin),
 	LCF(echochar),
 	LCF(erase),
+	LCF(framestats),
 	LCF(getattrs),
 	LCF(getbegyx),
 	LCF(getbkgd),
 	LCF(getch),
+	LCF(getch_all),
+	LCF(getch_count),
 	LCF(getmaxyx),
 	LCF(getparyx),
 	LCF(getstr),
@@ -1414,10 +2765,13 @@ static const luaL_Reg windowfuncs[] = {
 	LCF(noutrefresh),
 	LCF(overlay),
 	LCF(overwrite),
+	LCF(printw),
 	LCF(putwin),
+	LCF(read_region),
 	LCF(redrawln),
 	LCF(redrawwin),
 	LCF(refresh),
+	LCF(retain),
 	LCF(scrl),
 	LCF(scroll),
 	LCF(scrollok),
@@ -1442,19 +2796,16 @@ static const luaL_Reg windowfuncs[] = {
 	LCF(bkgrnd),
 	LCF(bkgrndset),
 	LCF(border_set),
-	LCF(wecho_wchar),
+	LCF(echo_wchar),
 	LCF(get_wch),
 	LCF(get_wstr),
 	LCF(getbkgrnd),
-	LCF(getn_wstr),
 	LCF(hline_set),
 	LCF(in_wch),
 	LCF(in_wchstr),
-	LCF(innwstr),
 	LCF(ins_wch),
 	LCF(ins_wstr),
 	LCF(inwstr),
-	LCF(unctrl),
 	LCF(vline_set),
 #endif
 #ifdef LC_NCURSES
@@ -1480,13 +2831,118 @@ static const luaL_Reg windowfuncs[] = {
 	{ NULL, NULL }
 };
 
+#undef LCF
+#define LCF(fn) { #fn, s_ ## fn }
+
+static const luaL_Reg stdscrfuncs[] = {
+	LCF(addch),
+	LCF(addch_at),
+	LCF(addchstr_at),
+	LCF(addstr),
+	LCF(addstr_at),
+	LCF(attr_get),
+	LCF(attr_off),
+	LCF(attr_on),
+	LCF(attr_set),
+	LCF(attroff),
+	LCF(attron),
+	LCF(attrset),
+	LCF(bkgd),
+	LCF(bkgdset),
+	LCF(border),
+	LCF(box),
+	LCF(chgat),
+	LCF(clear),
+	LCF(clrtobot),
+	LCF(clrtoeol),
+	LCF(delch),
+	LCF(deleteln),
+	LCF(echochar),
+	LCF(erase),
+	LCF(getch),
+	LCF(getch_all),
+	LCF(getch_count),
+	LCF(getstr),
+	LCF(hline),
+	LCF(inch),
+	LCF(insch),
+	LCF(insdelln),
+	LCF(insertln),
+	LCF(insstr),
+	LCF(instr),
+	LCF(keypad),
+	LCF(move),
+	LCF(printw),
+	LCF(refresh),
+	LCF(scrl),
+	LCF(setscrreg),
+	LCF(standend),
+	LCF(standout),
+	LCF(timeout),
+	LCF(vline),
+#ifdef LC_WIDE
+	LCF(add_wch),
+	LCF(addwstr),
+	LCF(border_set),
+	LCF(get_wch),
+	LCF(get_wstr),
+	LCF(hline_set),
+	LCF(in_wch),
+	LCF(ins_wch),
+	LCF(ins_wstr),
+	LCF(inwstr),
+	LCF(vline_set),
+#endif
+	{ NULL, NULL }
+};
+
 void lc_reg_window(lua_State *L)
 {
-	luaL_newmetatable(L, LC_WINDOWMT);
+	const luaL_Reg *reg;
+	lcstdscr *box;
+
+	/* weak-valued, so a cached userdata can still be collected */
+	lua_pushlightuserdata(L, &lc_proxies);
+	lua_newtable(L);
+	lua_newtable(L);
+	lua_pushstring(L, "v");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+
+	/* the handle pool; kept if we're loaded again into the same state */
+	if (!lc_getpool(L)) {
+		lcpool *pool;
+		lua_pushlightuserdata(L, &lc_poolkey);
+		pool = (lcpool*)lua_newuserdata(L, sizeof(lcpool));
+		memset(pool, 0, sizeof(lcpool));
+		pool->alloc = lua_getallocf(L, &pool->ud);
+		lua_newtable(L);
+		lua_pushcfunction(L, lc_poolgc);
+		lua_setfield(L, -2, "__gc");
+		lua_setmetatable(L, -2);
+		lua_rawset(L, LUA_REGISTRYINDEX);
+	}
+
+	lc_newmetatable(L, &lc_windowkey, LC_WINDOWMT);
 	lua_pushvalue(L, -1);
 	lua_setfield(L, -2, "__index");
 
 	LC_REGISTER(L, windowfuncs);
 
 	lua_setfield(L, -2, "_WINDOW");
+
+	/* load curses.* stdscr funcs, sharing the box stdscr is cached in */
+	box = (lcstdscr*)lua_newuserdata(L, sizeof(lcstdscr));
+	box->wh = NULL;
+	box->ref = LUA_NOREF;
+	for (reg = stdscrfuncs; reg->name; reg++) {
+		lua_pushvalue(L, -1);
+		lua_pushcclosure(L, reg->func, 1);
+		lua_setfield(L, -3, reg->name);
+	}
+	lua_pop(L, 1);
+
+	lua_pushcfunction(L, c__handlestats);
+	lua_setfield(L, -2, "_handlestats");
 }
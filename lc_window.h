@@ -5,37 +5,119 @@
 
 #define LC_WINDOWMT "lc-window"
 
+extern char lc_windowkey; /* registry key of the window metatable */
+
+/* a cell of a retain()ed window's shadow; wide text needs the whole cchar_t */
+#ifdef LC_WIDE
+typedef cchar_t lccell;
+#define LC_CELLEQ(a, b) (!memcmp(&(a), &(b), sizeof(cchar_t)))
+#define lc_mvwincells(w, y, x, buf, n) mvwin_wchnstr(w, y, x, buf, n)
+#else
+typedef chtype lccell;
+#define LC_CELLEQ(a, b) ((a) == (b))
+#define lc_mvwincells(w, y, x, buf, n) mvwinchnstr(w, y, x, buf, n)
+#endif
+
+/* a cell's attributes and UTF-8 length, for estimating what curses sends */
+#if defined(LC_WIDE) && defined(NCURSES_VERSION)
+#define LC_CELLATTR(c)  ((c).attr)
+#define LC_CELLBYTES(c) \
+	((c).chars[0] < 0x80 ? 1 : (c).chars[0] < 0x800 ? 2 : (c).chars[0] < 0x10000 ? 3 : 4)
+#elif defined(LC_WIDE)
+#define LC_CELLATTR(c)  0 /* cchar_t is opaque */
+#define LC_CELLBYTES(c) 1
+#else
+#define LC_CELLATTR(c)  ((c) & A_ATTRIBUTES)
+#define LC_CELLBYTES(c) 1
+#endif
+
 typedef struct winhandle {
-  struct winhandle *parent, *sub, *next, *hnext;
+  struct winhandle *parent, *sub, *next, *prev; /* subwindow tree */
+  struct lcslab *slab; /* the pool block we were allocated from */
   WINDOW *win;
   PANEL *pan;
   int refs;
+  int borrowed;      /* closing us doesn't delwin() (stdscr, other states' panels) */
+  int parentref;     /* registry ref keeping our parent's userdata alive */
+  int delay;         /* last timeout() delay, for curses that can't report it */
+  lccell *shadow;    /* cells as of the last refresh, if retain()ed */
+  int shadowh, shadoww;
+  int statcells, statrows; /* what the last refresh actually changed */
+  int statbytes;     /* and roughly how much output that takes */
 } winhandle;
 
-extern winhandle *lc_winlist;
-
 void lc_reg_window(lua_State *L);
 
 /* pushes the existing handle for `w', or a new one if it doesn't exist */
 winhandle* lc_pushwindow(lua_State *L, WINDOW *w);
 
-/* pushes a reference to an existing winhandle */
+/* pushes the userdata for an existing winhandle, creating it if needed */
 winhandle* lc_pushhandle(lua_State *L, winhandle *wh);
 
 /* returns the handle for the given window, or NULL if it doesn't exist */
 winhandle* lc_findwindow(lua_State *L, WINDOW *w);
 
+/* returns true if `wh' came from this state's pool (see lc_panel.c) */
+int lc_ownhandle(lua_State *L, winhandle *wh);
+
+/* returns the handle at narg, even if its window has been deleted */
+winhandle* lc_tohandle(lua_State *L, int narg);
+
 winhandle* lc_checkhandle(lua_State *L, int narg);
 WINDOW*    lc_checkwindow(lua_State *L, int narg);
 
-/* if first 2 args are numbers, pops them and does a wmove() */
+/* if the args at narg and narg+1 are numbers, removes them and does a wmove() */
 /* if wmove() fails, pushes 'false' (or 'nil' if pushnil=1) and returns 0 */
-int lc_checkmv(lua_State *L, WINDOW *w, int pushnil);
+int lc_checkmv(lua_State *L, WINDOW *w, int narg, int pushnil);
+
+/*
+* returns the window's current timeout() delay, so it can be put back.
+* without ncurses this is the delay last set through the binding.
+*/
+int lc_getdelay(lua_State *L, WINDOW *w);
+
+/* returns whether keypad() is on for the window (assumed on if we can't ask) */
+int lc_getkeypad(WINDOW *w);
+
+/*
+* returns a private 1x1 pad, in nodelay mode and with keypad() set to `kp',
+* for reading input without wgetch()'s refresh of the window it's read from
+* (pads are never refreshed by it). NULL if it couldn't be made.
+*/
+WINDOW* lc_inputpad(int kp);
+
+/*
+* key code getch() returns at the start of a bracketed paste, or 0 while
+* curses.bracketed_paste() is off. it's picked when paste mode is turned on,
+* from the codes the terminal's own keys don't use.
+*/
+extern int lc_pastekey;
+#define LC_ISPASTE(ch) (lc_pastekey > 0 && (ch) == lc_pastekey)
+
+#define LC_PASTE_BEGIN "\033[200~"
+#define LC_PASTE_END   "\033[201~"
+
+/* reads the rest of a paste after lc_pastekey and pushes it as a string */
+void lc_pushpaste(lua_State *L, WINDOW *w);
+
+/*
+* takes any copies of `ch' already waiting in the input queue (without
+* blocking) and returns how many there were, counting `ch' itself.
+* the first different key is pushed back with ungetch().
+*/
+int lc_countrepeats(lua_State *L, WINDOW *w, int ch);
+
+/*
+* makes `wh' a subwindow of the window at `parent', so it's deleted along
+* with it. the parent's userdata is kept alive for as long as wh's is, so
+* it can't be collected (closing wh) while wh is still in use.
+*/
+void lc_linkhandle(lua_State *L, int parent, winhandle *wh);
 
-int lc_close_handle(winhandle *wh, int top);
+int lc_close_tree(winhandle *wh, int *count);
 
 /* calls delwin() on the handle's window, and all of its subwindows */
 /* (without freeing the handle itself) */
-#define lc_closehandle(wh) (lc_close_handle(wh, 1))
+#define lc_closehandle(wh) (lc_close_tree(wh, NULL))
 
 #endif
@@ -0,0 +1,161 @@
+#include "lc_winmap.h"
+#include <stdlib.h>
+
+#define WINMAP_MINSIZE 16 /* must be a power of 2 */
+
+/* fibonacci hashing; the low bits of heap pointers are mostly zero */
+#define WINMAP_HASH(map, w) \
+	((((size_t)(w) >> 4) * (size_t)2654435769UL) & ((map)->size - 1))
+
+/* distance of the entry in `slot' from its home slot */
+#define WINMAP_DIST(map, slot, home) (((slot) - (home)) & ((map)->size - 1))
+
+static size_t lc_winmap_find(lcwinmap *map, WINDOW *w)
+{
+	size_t i = WINMAP_HASH(map, w);
+	while (map->slots[i] && map->slots[i]->win != w)
+		i = (i + 1) & (map->size - 1);
+	return i;
+}
+
+/*
+* reallocates the table with `size' slots and reinserts everything.
+* returns 0 (leaving the old table alone) if we're out of memory.
+*/
+static int lc_winmap_resize(lcwinmap *map, size_t size)
+{
+	winhandle **old = map->slots;
+	size_t oldsize = map->size;
+	winhandle **slots = calloc(size, sizeof(winhandle*));
+	size_t i;
+
+	if (!slots)
+		return 0;
+
+	map->slots = slots;
+	map->size = size;
+
+	for (i = 0; i < oldsize; i++) {
+		if (old[i])
+			map->slots[lc_winmap_find(map, old[i]->win)] = old[i];
+	}
+	free(old);
+	return 1;
+}
+
+winhandle* lc_winmap_get(lcwinmap *map, WINDOW *w)
+{
+	if (!w || !map->count)
+		return NULL;
+	return map->slots[lc_winmap_find(map, w)];
+}
+
+int lc_winmap_put(lcwinmap *map, winhandle *wh)
+{
+	size_t i;
+
+	/* keep the load factor at or below 1/2 so probe runs stay short */
+	if ((map->count + 1) * 2 > map->size) {
+		size_t size = map->size ? map->size * 2 : WINMAP_MINSIZE;
+		if (!lc_winmap_resize(map, size) && map->count + 1 >= map->size)
+			return 0;
+	}
+
+	i = lc_winmap_find(map, wh->win);
+	if (!map->slots[i])
+		map->count++;
+	map->slots[i] = wh;
+	return 1;
+}
+
+void lc_winmap_del(lcwinmap *map, WINDOW *w)
+{
+	size_t i, j;
+
+	if (!w || !map->count)
+		return;
+
+	i = lc_winmap_find(map, w);
+	if (!map->slots[i])
+		return;
+
+	/*
+	* no tombstones: shift later entries of the probe run back into the gap,
+	* unless that would move one in front of its home slot.
+	*/
+	j = i;
+	for (;;) {
+		j = (j + 1) & (map->size - 1);
+		if (!map->slots[j])
+			break;
+		if (WINMAP_DIST(map, j, WINMAP_HASH(map, map->slots[j]->win)) >=
+		    WINMAP_DIST(map, j, i)) {
+			map->slots[i] = map->slots[j];
+			i = j;
+		}
+	}
+	map->slots[i] = NULL;
+	map->count--;
+
+	/* shrink once we're below 1/8 full; failing to is harmless */
+	if (map->size > WINMAP_MINSIZE && map->count * 8 < map->size)
+		lc_winmap_resize(map, map->size / 2);
+}
+
+winhandle* lc_winmap_next(lcwinmap *map, size_t *iter)
+{
+	while (*iter < map->size) {
+		winhandle *wh = map->slots[(*iter)++];
+		if (wh)
+			return wh;
+	}
+	return NULL;
+}
+
+void lc_winmap_free(lcwinmap *map)
+{
+	free(map->slots);
+	map->slots = NULL;
+	map->size = 0;
+	map->count = 0;
+}
+
+static void lc_winmap_probes(lcwinmap *map, size_t *maxp, double *avgp)
+{
+	size_t i, total = 0;
+	*maxp = 0;
+	for (i = 0; i < map->size; i++) {
+		size_t d;
+		if (!map->slots[i])
+			continue;
+		d = WINMAP_DIST(map, i, WINMAP_HASH(map, map->slots[i]->win)) + 1;
+		total += d;
+		if (d > *maxp)
+			*maxp = d;
+	}
+	*avgp = map->count ? (double)total / map->count : 0;
+}
+
+/*
+* int count, int size, num load, int maxprobe, num avgprobe = curses._winmapstats()
+* Debugging aid: reports the state of this lua_State's window handle table.
+*/
+static LUA_PROTO(c__winmapstats)
+{
+	lcwinmap *map = lc_getwinmap(L);
+	size_t maxp;
+	double avgp;
+	lc_winmap_probes(map, &maxp, &avgp);
+	lua_pushinteger(L, map->count);
+	lua_pushinteger(L, map->size);
+	lua_pushnumber(L, map->size ? (double)map->count / map->size : 0);
+	lua_pushinteger(L, maxp);
+	lua_pushnumber(L, avgp);
+	return 5;
+}
+
+void lc_reg_winmap(lua_State *L)
+{
+	lua_pushcfunction(L, c__winmapstats);
+	lua_setfield(L, -2, "_winmapstats");
+}
@@ -0,0 +1,38 @@
+#ifndef LC_WINMAP_H
+#define LC_WINMAP_H
+
+#include "lc_window.h"
+
+/*
+* open-addressed hash table mapping live WINDOW*s to their winhandles.
+* keyed on wh->win, so a handle must be removed BEFORE its window is deleted.
+* each lua_State has its own, so a handle is only ever reachable from the
+* state whose pool it came from.
+*/
+typedef struct lcwinmap {
+	winhandle **slots;
+	size_t size;  /* number of slots, 0 or a power of 2 */
+	size_t count; /* number of occupied slots */
+} lcwinmap;
+
+/* returns the calling state's map (it lives in the handle pool) */
+lcwinmap* lc_getwinmap(lua_State *L);
+
+/* returns the handle for `w', or NULL if it isn't in the map */
+winhandle* lc_winmap_get(lcwinmap *map, WINDOW *w);
+
+/* adds `wh' under wh->win. returns 0 if the table couldn't be grown */
+int lc_winmap_put(lcwinmap *map, winhandle *wh);
+
+/* removes the entry for `w', if any */
+void lc_winmap_del(lcwinmap *map, WINDOW *w);
+
+/* iterates over all handles; start with *iter = 0, returns NULL when done */
+winhandle* lc_winmap_next(lcwinmap *map, size_t *iter);
+
+/* frees the table itself, not the handles in it */
+void lc_winmap_free(lcwinmap *map);
+
+void lc_reg_winmap(lua_State *L);
+
+#endif
@@ -1,5 +1,8 @@
 local curses = require("luacurses")
 
+-- constants are normally loaded on first use; we need them all up front
+curses._loadconsts(curses)
+
 -- dump lib funcs into global
 for k, v in pairs(curses) do
   if k:sub(1, 1) ~= "_" then
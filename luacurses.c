@@ -3,6 +3,9 @@
 #include "lc_window.h"
 #include "lc_panel.h"
 #include "lc_chstr.h"
+#include "lc_winmap.h"
+#include "lc_event.h"
+#include <stdlib.h>
 
 #if LUA_VERSION_NUM >= 502
 int luaL_typerror(lua_State *L, int narg, const char *tname)
@@ -53,6 +56,83 @@ chtype luaL_optchar(lua_State *L, int narg, int d)
 	return luaL_checkchar(L, narg);
 }
 
+void lc_newmetatable(lua_State *L, void *key, const char *tname)
+{
+	luaL_newmetatable(L, tname);
+	lua_pushlightuserdata(L, key);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+}
+
+void lc_setmetatable(lua_State *L, void *key)
+{
+	lua_pushlightuserdata(L, key);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	lua_setmetatable(L, -2);
+}
+
+void* lc_testudata(lua_State *L, int narg, void *key)
+{
+	void *p = lua_touserdata(L, narg);
+	if (p != NULL && lua_getmetatable(L, narg)) {
+		lua_pushlightuserdata(L, key);
+		lua_rawget(L, LUA_REGISTRYINDEX);
+		if (!lua_rawequal(L, -1, -2))
+			p = NULL;
+		lua_pop(L, 2);
+		return p;
+	}
+	return NULL;
+}
+
+void* lc_checkudata(lua_State *L, int narg, void *key, const char *tname)
+{
+	void *p = lc_testudata(L, narg, key);
+	if (p == NULL)
+		luaL_typerror(L, narg, tname);
+	return p;
+}
+
+/* each state's scratch buffer lives in a registry userdata, freed with it */
+typedef struct lcscratch {
+	char *buf;
+	size_t size;
+} lcscratch;
+
+static char lc_scratchkey;
+
+static LUA_PROTO(lc_scratchgc)
+{
+	lcscratch *sc = (lcscratch*)lua_touserdata(L, 1);
+	free(sc->buf);
+	sc->buf = NULL;
+	sc->size = 0;
+	return 0;
+}
+
+static lcscratch* lc_getscratch(lua_State *L)
+{
+	lcscratch *sc;
+	lua_pushlightuserdata(L, &lc_scratchkey);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	sc = (lcscratch*)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return sc;
+}
+
+char* lc_scratch(lua_State *L, size_t n)
+{
+	lcscratch *sc = lc_getscratch(L);
+	if (n > sc->size) {
+		char *nbuf = realloc(sc->buf, n);
+		if (!nbuf)
+			luaL_error(L, "out of memory");
+		sc->buf = nbuf;
+		sc->size = n;
+	}
+	return sc->buf;
+}
+
 void lua_stackdump(lua_State *L) {
 	int i = lua_gettop(L);
 	printf("--- Stack dump ---\n");
@@ -79,12 +159,28 @@ void lua_stackdump(lua_State *L) {
 
 LUA_PROTO(luaopen_curses_core)
 {
+	/* kept if we're loaded again into the same state */
+	if (!lc_getscratch(L)) {
+		lcscratch *sc;
+		lua_pushlightuserdata(L, &lc_scratchkey);
+		sc = (lcscratch*)lua_newuserdata(L, sizeof(lcscratch));
+		sc->buf = NULL;
+		sc->size = 0;
+		lua_newtable(L);
+		lua_pushcfunction(L, lc_scratchgc);
+		lua_setfield(L, -2, "__gc");
+		lua_setmetatable(L, -2);
+		lua_rawset(L, LUA_REGISTRYINDEX);
+	}
+
 	lua_newtable(L);
 
 	lc_reg_lib(L);
 	lc_reg_window(L);
 	lc_reg_panel(L);
 	lc_reg_chstr(L);
+	lc_reg_winmap(L);
+	lc_reg_event(L);
 
 	lua_pushstring(L, LC_VERSION);
 	lua_setfield(L, -2, "_VERSION");
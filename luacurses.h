@@ -1,9 +1,21 @@
 #ifndef LUACURSES_H
 #define LUACURSES_H
 
+/*
+* the wide-character functions need X/Open curses (ncursesw). define
+* LC_NOWIDE to build against a curses without them.
+*/
+#if !defined(LC_NOWIDE) && !defined(_XOPEN_SOURCE_EXTENDED)
+#define _XOPEN_SOURCE_EXTENDED 1
+#endif
+
 #include <curses.h>
 #include <panel.h>
 
+#if !defined(LC_NOWIDE) && defined(WACS_HLINE)
+#define LC_WIDE
+#endif
+
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
@@ -18,9 +30,11 @@
 
 #if LUA_VERSION_NUM >= 502
 #define LC_REGISTER(L,reg) luaL_setfuncs((L),(reg),0)
+#define LC_RAWLEN(L,i)     lua_rawlen((L),(i))
 int luaL_typerror(lua_State *L, int narg, const char *tname);
 #else
 #define LC_REGISTER(L,reg) luaL_register((L),NULL,(reg))
+#define LC_RAWLEN(L,i)     lua_objlen((L),(i))
 void luaL_setmetatable(lua_State *L, const char *tname);
 #endif
 
@@ -30,6 +44,23 @@ chtype luaL_checkchar(lua_State *L, int narg);
 chtype luaL_optchar(lua_State *L, int narg, int d);
 void lua_stackdump(lua_State *L);
 
+/*
+* our metatables are also kept in the registry under the address of a
+* static char, so type checks don't have to look them up by name.
+*/
+void  lc_newmetatable(lua_State *L, void *key, const char *tname);
+void  lc_setmetatable(lua_State *L, void *key);
+void* lc_testudata(lua_State *L, int narg, void *key);
+void* lc_checkudata(lua_State *L, int narg, void *key, const char *tname);
+
+/*
+* returns the state's reusable buffer of at least n bytes, valid until the
+* next call. its contents are kept when it has to grow. no Lua code may run
+* while it's in use (a metamethod or callback could take it over), so
+* convert arguments before filling it.
+*/
+char* lc_scratch(lua_State *L, size_t n);
+
 extern int lc_initonce;
 
 #endif